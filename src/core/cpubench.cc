@@ -0,0 +1,461 @@
+/*
+ * cpubench.cc
+ *
+ * CPU micro-kernels: integer hashing, branchy text parsing, single
+ * precision matrix multiply and hardware CRC32C / AES when CPUID
+ * reports them.
+ *
+ * Every kernel runs the same amount of work per thread; the score is
+ * the total number of operations divided by the wall-clock time between
+ * the moment all threads are ready and the moment the last one is done.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <sys/time.h>
+#include <omp.h>
+#if defined(__i386__) || defined(__x86_64__)
+#include <nmmintrin.h>
+#include <wmmintrin.h>
+#endif
+#include "cpubench.h"
+
+#define HASH_WORDS 4096
+#define HASH_ROUNDS 65536
+
+#define PARSE_BYTES 65536
+#define PARSE_ROUNDS 2048
+
+#define SGEMM_N 128
+#define SGEMM_ROUNDS 1024
+
+#define CRC_BYTES 65536
+#define CRC_ROUNDS 32768
+
+#define AES_BLOCKS 4096
+#define AES_ROUNDS 32768
+
+struct kernel
+{
+    void *(*prepare)(void);
+    unsigned long long (*run)(void *);
+};
+
+static double now()
+{
+    struct timeval tp;
+
+    gettimeofday(&tp, NULL);
+    return (double) tp.tv_sec + (double) tp.tv_usec * 1.e-6;
+}
+
+static double run_kernel(const struct kernel & k, int threads)
+{
+    unsigned long long ops = 0;
+    double start = 0, end = 0;
+
+    if(threads <= 0)
+        threads = omp_get_num_procs();
+
+#pragma omp parallel num_threads(threads) reduction(+:ops)
+    {
+        void *state = k.prepare();
+
+#pragma omp barrier
+#pragma omp single
+        start = now();
+
+        if(state)
+            ops += k.run(state);
+
+#pragma omp barrier
+#pragma omp single
+        end = now();
+
+        free(state);
+    }
+
+    if(end <= start)
+        return 0;
+
+    return ops / (end - start);
+}
+
+/*
+ * integer hashing: xxh64-style multiply/rotate rounds on four lanes
+ */
+
+#define PRIME64_1 0x9E3779B185EBCA87ULL
+#define PRIME64_2 0xC2B2AE3D27D4EB4FULL
+
+static inline uint64_t rotl64(uint64_t x, int r)
+{
+    return (x << r) | (x >> (64 - r));
+}
+
+static inline uint64_t hash_round(uint64_t acc, uint64_t input)
+{
+    acc += input * PRIME64_2;
+    acc = rotl64(acc, 31);
+    return acc * PRIME64_1;
+}
+
+static void *hash_prepare()
+{
+    uint64_t *words = (uint64_t *) malloc(HASH_WORDS * sizeof(uint64_t));
+
+    if(words)
+        for(int i = 0; i < HASH_WORDS; i++)
+            words[i] = (uint64_t) i * PRIME64_1;
+
+    return words;
+}
+
+static unsigned long long hash_run(void *state)
+{
+    const uint64_t *words = (const uint64_t *) state;
+    uint64_t v1 = PRIME64_1 + PRIME64_2, v2 = PRIME64_2, v3 = 0, v4 = -PRIME64_1;
+    volatile uint64_t sink;
+
+    for(int r = 0; r < HASH_ROUNDS; r++)
+        for(int i = 0; i < HASH_WORDS; i += 4)
+        {
+            v1 = hash_round(v1, words[i]);
+            v2 = hash_round(v2, words[i + 1]);
+            v3 = hash_round(v3, words[i + 2]);
+            v4 = hash_round(v4, words[i + 3]);
+        }
+    sink = rotl64(v1, 1) + rotl64(v2, 7) + rotl64(v3, 12) + rotl64(v4, 18);
+    (void) sink;
+
+    return (unsigned long long) HASH_WORDS * HASH_ROUNDS;
+}
+
+/*
+ * branchy parsing: "key=value" records with signed decimal and hex
+ * fields of random width, similar to /proc or sysfs text
+ */
+
+static void *parse_prepare()
+{
+    char *text = (char *) malloc(PARSE_BYTES + 1);
+    unsigned int seed = 12345;
+    size_t len = 0;
+
+    if(!text)
+        return NULL;
+
+    while(len < PARSE_BYTES - 32)
+    {
+        unsigned int r = rand_r(&seed);
+
+        switch(r % 4)
+        {
+            case 0:
+                len += snprintf(text + len, 32, "k%u=%d,", r % 97, (int) (r >> 3) - (1 << 27));
+                break;
+            case 1:
+                len += snprintf(text + len, 32, "k%u=0x%x,", r % 97, r >> (r % 24));
+                break;
+            case 2:
+                len += snprintf(text + len, 32, "k%u=%u\n", r % 97, r % 1000);
+                break;
+            default:
+                len += snprintf(text + len, 32, "k%u= %u ,", r % 97, r >> 20);
+        }
+    }
+    memset(text + len, 0, PARSE_BYTES + 1 - len);
+
+    return text;
+}
+
+static unsigned long long parse_run(void *state)
+{
+    const char *text = (const char *) state;
+    unsigned long long fields = 0;
+    long long total = 0;
+    volatile long long sink;
+
+    for(int r = 0; r < PARSE_ROUNDS; r++)
+    {
+        const char *p = text;
+
+        while(*p)
+        {
+            long long value = 0;
+            bool negative = false;
+
+            while(*p && *p != '=')
+                p++;
+            if(!*p)
+                break;
+            p++;
+            while(*p == ' ')
+                p++;
+            if(*p == '-')
+            {
+                negative = true;
+                p++;
+            }
+            if(p[0] == '0' && p[1] == 'x')
+            {
+                p += 2;
+                for(;; p++)
+                {
+                    if(*p >= '0' && *p <= '9')
+                        value = (value << 4) | (*p - '0');
+                    else if(*p >= 'a' && *p <= 'f')
+                        value = (value << 4) | (*p - 'a' + 10);
+                    else
+                        break;
+                }
+            }
+            else
+                while(*p >= '0' && *p <= '9')
+                    value = value * 10 + (*p++ - '0');
+
+            total += negative ? -value : value;
+            fields++;
+        }
+    }
+    sink = total;
+    (void) sink;
+
+    return fields;
+}
+
+/*
+ * SGEMM: C += A * B on square float matrices, i-k-j order so the inner
+ * loop vectorises
+ */
+
+static void *sgemm_prepare()
+{
+    float *m = (float *) malloc(3 * SGEMM_N * SGEMM_N * sizeof(float));
+
+    if(m)
+        for(int i = 0; i < 3 * SGEMM_N * SGEMM_N; i++)
+            m[i] = (float) (i % 13) * 0.25f;
+
+    return m;
+}
+
+static unsigned long long sgemm_run(void *state)
+{
+    const float *a = (const float *) state;
+    const float *b = a + SGEMM_N * SGEMM_N;
+    float *c = (float *) state + 2 * SGEMM_N * SGEMM_N;
+    volatile float sink;
+
+    for(int r = 0; r < SGEMM_ROUNDS; r++)
+        for(int i = 0; i < SGEMM_N; i++)
+            for(int k = 0; k < SGEMM_N; k++)
+            {
+                const float aik = a[i * SGEMM_N + k];
+                const float *bk = b + k * SGEMM_N;
+                float *ci = c + i * SGEMM_N;
+
+                for(int j = 0; j < SGEMM_N; j++)
+                    ci[j] += aik * bk[j];
+            }
+    sink = c[SGEMM_N * SGEMM_N - 1];
+    (void) sink;
+
+    return 2ULL * SGEMM_N * SGEMM_N * SGEMM_N * SGEMM_ROUNDS;
+}
+
+/*
+ * CRC32C (Castagnoli), SSE4.2 crc32 instruction or a lookup table
+ */
+
+static uint32_t crc32c_table[256];
+
+static void crc32c_init()
+{
+    for(uint32_t i = 0; i < 256; i++)
+    {
+        uint32_t crc = i;
+
+        for(int j = 0; j < 8; j++)
+            crc = (crc >> 1) ^ (0x82F63B78 & (0 - (crc & 1)));
+        crc32c_table[i] = crc;
+    }
+}
+
+static uint32_t crc32c_soft(uint32_t crc, const unsigned char *buf, size_t len)
+{
+    crc = ~crc;
+    while(len--)
+        crc = crc32c_table[(crc ^ *buf++) & 0xff] ^ (crc >> 8);
+
+    return ~crc;
+}
+
+#if defined(__x86_64__)
+__attribute__((target("sse4.2")))
+static uint32_t crc32c_hard(uint32_t crc, const unsigned char *buf, size_t len)
+{
+    uint64_t c = ~crc;
+
+    for(; len >= 8; len -= 8, buf += 8)
+    {
+        uint64_t word;
+
+        memcpy(&word, buf, sizeof(word));
+        c = _mm_crc32_u64(c, word);
+    }
+    while(len--)
+        c = _mm_crc32_u8((uint32_t) c, *buf++);
+
+    return ~(uint32_t) c;
+}
+#endif
+
+static bool has_hardware_crc32()
+{
+#if defined(__x86_64__)
+    return __builtin_cpu_supports("sse4.2");
+#else
+    return false;
+#endif
+}
+
+static void *crc_prepare()
+{
+    unsigned char *buf = (unsigned char *) malloc(CRC_BYTES);
+
+    if(buf)
+        for(int i = 0; i < CRC_BYTES; i++)
+            buf[i] = (unsigned char) (i * 7 + (i >> 8));
+
+    return buf;
+}
+
+static unsigned long long crc_run(void *state)
+{
+    const unsigned char *buf = (const unsigned char *) state;
+    uint32_t crc = 0;
+    volatile uint32_t sink;
+
+#if defined(__x86_64__)
+    if(has_hardware_crc32())
+    {
+        for(int r = 0; r < CRC_ROUNDS; r++)
+            crc = crc32c_hard(crc, buf, CRC_BYTES);
+        sink = crc;
+        (void) sink;
+        return (unsigned long long) CRC_BYTES * CRC_ROUNDS;
+    }
+#endif
+    // the table lookup is roughly 8x slower, keep the run time similar
+    for(int r = 0; r < CRC_ROUNDS / 8; r++)
+        crc = crc32c_soft(crc, buf, CRC_BYTES);
+    sink = crc;
+    (void) sink;
+
+    return (unsigned long long) CRC_BYTES * (CRC_ROUNDS / 8);
+}
+
+/*
+ * AES-128: ten aesenc rounds, four independent blocks in flight (as in
+ * CTR mode) so that the pipeline is kept full
+ */
+
+#if defined(__i386__) || defined(__x86_64__)
+__attribute__((target("aes,sse2")))
+static unsigned long long aes_run(void *state)
+{
+    const __m128i *blocks = (const __m128i *) state;
+    __m128i key[11];
+    __m128i acc = _mm_setzero_si128();
+    volatile int sink;
+
+    for(int i = 0; i < 11; i++)
+        key[i] = _mm_set_epi32(i * 0x01010101, i, ~i, i << 16);
+
+    for(int r = 0; r < AES_ROUNDS; r++)
+        for(int i = 0; i < AES_BLOCKS; i += 4)
+        {
+            __m128i b0 = _mm_xor_si128(blocks[i], key[0]);
+            __m128i b1 = _mm_xor_si128(blocks[i + 1], key[0]);
+            __m128i b2 = _mm_xor_si128(blocks[i + 2], key[0]);
+            __m128i b3 = _mm_xor_si128(blocks[i + 3], key[0]);
+
+            for(int k = 1; k < 10; k++)
+            {
+                b0 = _mm_aesenc_si128(b0, key[k]);
+                b1 = _mm_aesenc_si128(b1, key[k]);
+                b2 = _mm_aesenc_si128(b2, key[k]);
+                b3 = _mm_aesenc_si128(b3, key[k]);
+            }
+            b0 = _mm_aesenclast_si128(b0, key[10]);
+            b1 = _mm_aesenclast_si128(b1, key[10]);
+            b2 = _mm_aesenclast_si128(b2, key[10]);
+            b3 = _mm_aesenclast_si128(b3, key[10]);
+
+            acc = _mm_xor_si128(acc, _mm_xor_si128(_mm_xor_si128(b0, b1), _mm_xor_si128(b2, b3)));
+        }
+    sink = _mm_cvtsi128_si32(acc);
+    (void) sink;
+
+    return (unsigned long long) AES_BLOCKS * AES_ROUNDS;
+}
+
+static void *aes_prepare()
+{
+    void *blocks = NULL;
+
+    if(posix_memalign(&blocks, 16, AES_BLOCKS * 16) != 0)
+        return NULL;
+    for(int i = 0; i < AES_BLOCKS * 16; i++)
+        ((unsigned char *) blocks)[i] = (unsigned char) (i * 31);
+
+    return blocks;
+}
+#endif
+
+double cpu_hash(int threads)
+{
+    struct kernel k = {hash_prepare, hash_run};
+
+    return run_kernel(k, threads);
+}
+
+double cpu_parse(int threads)
+{
+    struct kernel k = {parse_prepare, parse_run};
+
+    return run_kernel(k, threads);
+}
+
+double cpu_sgemm(int threads)
+{
+    struct kernel k = {sgemm_prepare, sgemm_run};
+
+    return run_kernel(k, threads);
+}
+
+double cpu_crc32(int threads)
+{
+    struct kernel k = {crc_prepare, crc_run};
+
+    if(!has_hardware_crc32() && crc32c_table[1] == 0)
+        crc32c_init();
+
+    return run_kernel(k, threads);
+}
+
+double cpu_aes(int threads)
+{
+#if defined(__i386__) || defined(__x86_64__)
+    if(__builtin_cpu_supports("aes"))
+    {
+        struct kernel k = {aes_prepare, aes_run};
+
+        return run_kernel(k, threads);
+    }
+#endif
+    return 0;
+}
@@ -0,0 +1,13 @@
+#ifndef _CPUBENCH_H_
+#define _CPUBENCH_H_
+
+/*
+ * CPU micro-kernels, each returns operations per second.
+ * threads == 1 runs single-threaded, threads <= 0 uses every CPU.
+ */
+double cpu_hash(int threads);   // 64-bit words hashed
+double cpu_parse(int threads);  // decimal fields parsed
+double cpu_sgemm(int threads);  // single precision FLOPs
+double cpu_crc32(int threads);  // bytes checksummed (CRC32C)
+double cpu_aes(int threads);    // 128-bit blocks encrypted, 0 without AES-NI
+#endif
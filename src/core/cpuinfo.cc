@@ -6,11 +6,11 @@
 #include <unistd.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <vector>
+#include <algorithm>
 
 
-static int currentcpu = 0;
-
 static hwNode *getcpu(hwNode & node,
         int n = 0)
 {
@@ -45,148 +45,214 @@ static hwNode *getcpu(hwNode & node,
         return NULL;
 }
 
-static void cpuinfo_x86(hwNode & node, string id, string value)
+/*
+ * one "id : value" line of /proc/cpuinfo, pointing into the file contents
+ * with blanks trimmed on both sides
+ */
+struct cpuinfo_field
+{
+    const char *line;
+    const char *id;
+    size_t idlen;
+    const char *value;
+    size_t valuelen;
+};
+
+struct cpuinfo_block
 {
-    static int siblings = -1;
+    const char *begin;
+    const char *end;
+    long physid;
+};
 
-    if(currentcpu < 0) siblings = -1;
+static void trim(const char *&begin, const char *&end)
+{
+    while((begin < end) && ((unsigned char) *begin <= ' '))
+        begin++;
+    while((end > begin) && ((unsigned char) end[-1] <= ' '))
+        end--;
+}
 
-    if((siblings < 0) && (id == "siblings"))
+// false at the end of the data, lines without ':' are skipped
+static bool next_field(const char *&p, const char *end, cpuinfo_field & f)
+{
+    while(p < end)
     {
-        siblings = atoi(value.c_str());
-        siblings--;
+        const char *eol = (const char *) memchr(p, '\n', end - p);
+        const char *colon = NULL;
+        const char *idend = NULL;
+        const char *valueend = NULL;
+
+        if(!eol)
+            eol = end;
+        f.line = p;
+        colon = (const char *) memchr(p, ':', eol - p);
+        p = (eol < end) ? eol + 1 : end;
+        if(!colon)
+            continue;
+
+        f.id = f.line;
+        idend = colon;
+        trim(f.id, idend);
+        f.idlen = idend - f.id;
+        f.value = colon + 1;
+        valueend = eol;
+        trim(f.value, valueend);
+        f.valuelen = valueend - f.value;
+        return true;
     }
 
-    if(id == "processor")
-    {
-        siblings--;
+    return false;
+}
 
-        if(siblings >= 0)
-            return;
-        else
-            currentcpu++;
-    }
+static bool is(const cpuinfo_field & f, const char *id)
+{
+    return (strlen(id) == f.idlen) && (memcmp(f.id, id, f.idlen) == 0);
+}
+
+static bool yes(const cpuinfo_field & f)
+{
+    return (f.valuelen == 3) && (memcmp(f.value, "yes", 3) == 0);
+}
 
-    hwNode *cpu = getcpu(node, currentcpu);
+static string value(const cpuinfo_field & f)
+{
+    return string(f.value, f.valuelen);
+}
 
-    if(cpu)
-    {
+static void describe_x86(hwNode * cpu)
+{
+    cpu->describeCapability("fpu", "mathematical co-processor");
+    cpu->describeCapability("vme", "virtual mode extensions");
+    cpu->describeCapability("de", "debugging extensions");
+    cpu->describeCapability("pse", "page size extensions");
+    cpu->describeCapability("tsc", "time stamp counter");
+    cpu->describeCapability("msr", "model-specific registers");
+    cpu->describeCapability("mce", "machine check exceptions");
+    cpu->describeCapability("cx8", "compare and exchange 8-byte");
+    cpu->describeCapability("apic", "on-chip advanced programmable interrupt controller (APIC)");
+    cpu->describeCapability("sep", "fast system calls");
+    cpu->describeCapability("mtrr", "memory type range registers");
+    cpu->describeCapability("pge", "page global enable");
+    cpu->describeCapability("mca", "machine check architecture");
+    cpu->describeCapability("cmov", "conditional move instruction");
+    cpu->describeCapability("pat", "page attribute table");
+    cpu->describeCapability("pse36", "36-bit page size extensions");
+    cpu->describeCapability("pn", "processor serial number");
+    cpu->describeCapability("psn", "processor serial number");
+    //cpu->describeCapability("clflush", "");
+    cpu->describeCapability("dts", "debug trace and EMON store MSRs");
+    cpu->describeCapability("acpi", "thermal control (ACPI)");
+    cpu->describeCapability("fxsr", "fast floating point save/restore");
+    cpu->describeCapability("sse", "streaming SIMD extensions (SSE)");
+    cpu->describeCapability("sse2", "streaming SIMD extensions (SSE2)");
+    cpu->describeCapability("ss", "self-snoop");
+    cpu->describeCapability("tm", "thermal interrupt and status");
+    cpu->describeCapability("ia64", "IA-64 (64-bit Intel CPU)");
+    cpu->describeCapability("pbe", "pending break event");
+    cpu->describeCapability("syscall", "fast system calls");
+    cpu->describeCapability("mp", "multi-processor capable");
+    cpu->describeCapability("nx", "no-execute bit (NX)");
+    cpu->describeCapability("mmxext", "multimedia extensions (MMXExt)");
+    cpu->describeCapability("3dnowext", "multimedia extensions (3DNow!Ext)");
+    cpu->describeCapability("3dnow", "multimedia extensions (3DNow!)");
+    //cpu->describeCapability("recovery", "");
+    cpu->describeCapability("longrun", "LongRun Dynamic Power/Thermal Management");
+    cpu->describeCapability("lrti", "LongRun Table Interface");
+    cpu->describeCapability("cxmmx", "multimedia extensions (Cyrix MMX)");
+    cpu->describeCapability("k6_mtrr", "AMD K6 MTRRs");
+    //cpu->describeCapability("cyrix_arr", "");
+    //cpu->describeCapability("centaur_mcr", "");
+    //cpu->describeCapability("pni", "");
+    //cpu->describeCapability("monitor", "");
+    //cpu->describeCapability("ds_cpl", "");
+    //cpu->describeCapability("est", "");
+    //cpu->describeCapability("tm2", "");
+    //cpu->describeCapability("cid", "");
+    //cpu->describeCapability("xtpr", "");
+    cpu->describeCapability("rng", "random number generator");
+    cpu->describeCapability("rng_en", "random number generator (enhanced)");
+    cpu->describeCapability("ace", "advanced cryptography engine");
+    cpu->describeCapability("ace_en", "advanced cryptography engine (enhanced)");
+    cpu->describeCapability("ht", "HyperThreading");
+    cpu->describeCapability("lm", "64bits extensions (x86-64)");
+    cpu->describeCapability("x86-64", "64bits extensions (x86-64)");
+    cpu->describeCapability("mmx", "multimedia extensions (MMX)");
+    cpu->describeCapability("pae", "4GB+ memory addressing (Physical Address Extension)");
+}
+
+static void cpuinfo_x86(hwNode & node, hwNode * cpu, const cpuinfo_block & block)
+{
+    const char *p = block.begin;
+    cpuinfo_field f;
+
+    // x86 CPUs are assumed to be 32 bits per default
+    if(cpu->getWidth() == 0) cpu->setWidth(32);
 
-        // x86 CPUs are assumed to be 32 bits per default
-        if(cpu->getWidth() == 0) cpu->setWidth(32);
+    cpu->claim(true);
+    while(next_field(p, block.end, f))
+    {
+        if(is(f, "vendor_id"))
+        {
+            string vendor = value(f);
 
-        cpu->claim(true);
-        if(id == "vendor_id")
+            if(vendor == "AuthenticAMD")
+                vendor = "Advanced Micro Devices [AMD]";
+            if(vendor == "GenuineIntel")
+                vendor = "Intel Corp.";
+            cpu->setVendor(vendor);
+        }
+        else if(is(f, "model name"))
+            cpu->setProduct(hw::strip(value(f)));
+        else if(is(f, "Physical processor ID"))
+            cpu->setSerial(value(f));
+        else if(is(f, "fdiv_bug") || is(f, "hlt_bug") || is(f, "f00f_bug") ||
+            is(f, "coma_bug") || is(f, "fpu") || is(f, "wp"))
         {
-            if(value == "AuthenticAMD")
-                value = "Advanced Micro Devices [AMD]";
-            if(value == "GenuineIntel")
-                value = "Intel Corp.";
-            cpu->setVendor(value);
+            if(yes(f))
+                cpu->addCapability(string(f.id, f.idlen));
         }
-        if(id == "model name")
-        		cpu->setProduct(value);
-        //if ((id == "cpu MHz") && (cpu->getSize() == 0))
-        //{
-        //cpu->setSize((long long) (1000000L * atof(value.c_str())));
-        //}
-        if(id == "Physical processor ID")
-            cpu->setSerial(value);
-        if((id == "fdiv_bug") && (value == "yes"))
-            cpu->addCapability("fdiv_bug");
-        if((id == "hlt_bug") && (value == "yes"))
-            cpu->addCapability("hlt_bug");
-        if((id == "f00f_bug") && (value == "yes"))
-            cpu->addCapability("f00f_bug");
-        if((id == "coma_bug") && (value == "yes"))
-            cpu->addCapability("coma_bug");
-        if((id == "fpu") && (value == "yes"))
-            cpu->addCapability("fpu");
-        if((id == "wp") && (value == "yes"))
-            cpu->addCapability("wp");
-        if((id == "fpu_exception") && (value == "yes"))
-            cpu->addCapability("fpu_exception", "FPU exceptions reporting");
-        if(id == "flags")
-            while(value.length() > 0)
-            {
-                size_t pos = value.find(' ');
-                string capability = (pos == string::npos) ? value : value.substr(0, pos);
+        else if(is(f, "fpu_exception"))
+        {
+            if(yes(f))
+                cpu->addCapability("fpu_exception", "FPU exceptions reporting");
+        }
+        else if(is(f, "flags"))
+        {
+            const char *flag = f.value;
+            const char *end = f.value + f.valuelen;
 
-                if(capability == "lm") capability = "x86-64";
+            while(flag < end)
+            {
+                const char *next = flag;
+
+                while((next < end) && (*next != ' ') && (*next != '\t'))
+                    next++;
+                if(next > flag)
+                {
+                    if((next - flag == 2) && (memcmp(flag, "lm", 2) == 0))
+                        cpu->addCapability("x86-64");
+                    else
+                        cpu->addCapability(string(flag, next - flag));
+                }
+                flag = next + 1;
+            }
+        }
+    }
 
-                cpu->addCapability(capability);
+    describe_x86(cpu);
 
-                if(pos == string::npos)
-                    value = "";
-                else
-                    value = hw::strip(value.substr(pos));
-            }
+    if(cpu->isCapable("ia64") || cpu->isCapable("lm") || cpu->isCapable("x86-64"))
+        cpu->setWidth(64);
 
-        cpu->describeCapability("fpu", "mathematical co-processor");
-        cpu->describeCapability("vme", "virtual mode extensions");
-        cpu->describeCapability("de", "debugging extensions");
-        cpu->describeCapability("pse", "page size extensions");
-        cpu->describeCapability("tsc", "time stamp counter");
-        cpu->describeCapability("msr", "model-specific registers");
-        cpu->describeCapability("mce", "machine check exceptions");
-        cpu->describeCapability("cx8", "compare and exchange 8-byte");
-        cpu->describeCapability("apic", "on-chip advanced programmable interrupt controller (APIC)");
-        cpu->describeCapability("sep", "fast system calls");
-        cpu->describeCapability("mtrr", "memory type range registers");
-        cpu->describeCapability("pge", "page global enable");
-        cpu->describeCapability("mca", "machine check architecture");
-        cpu->describeCapability("cmov", "conditional move instruction");
-        cpu->describeCapability("pat", "page attribute table");
-        cpu->describeCapability("pse36", "36-bit page size extensions");
-        cpu->describeCapability("pn", "processor serial number");
-        cpu->describeCapability("psn", "processor serial number");
-        //cpu->describeCapability("clflush", "");
-        cpu->describeCapability("dts", "debug trace and EMON store MSRs");
-        cpu->describeCapability("acpi", "thermal control (ACPI)");
-        cpu->describeCapability("fxsr", "fast floating point save/restore");
-        cpu->describeCapability("sse", "streaming SIMD extensions (SSE)");
-        cpu->describeCapability("sse2", "streaming SIMD extensions (SSE2)");
-        cpu->describeCapability("ss", "self-snoop");
-        cpu->describeCapability("tm", "thermal interrupt and status");
-        cpu->describeCapability("ia64", "IA-64 (64-bit Intel CPU)");
-        cpu->describeCapability("pbe", "pending break event");
-        cpu->describeCapability("syscall", "fast system calls");
-        cpu->describeCapability("mp", "multi-processor capable");
-        cpu->describeCapability("nx", "no-execute bit (NX)");
-        cpu->describeCapability("mmxext", "multimedia extensions (MMXExt)");
-        cpu->describeCapability("3dnowext", "multimedia extensions (3DNow!Ext)");
-        cpu->describeCapability("3dnow", "multimedia extensions (3DNow!)");
-        //cpu->describeCapability("recovery", "");
-        cpu->describeCapability("longrun", "LongRun Dynamic Power/Thermal Management");
-        cpu->describeCapability("lrti", "LongRun Table Interface");
-        cpu->describeCapability("cxmmx", "multimedia extensions (Cyrix MMX)");
-        cpu->describeCapability("k6_mtrr", "AMD K6 MTRRs");
-        //cpu->describeCapability("cyrix_arr", "");
-        //cpu->describeCapability("centaur_mcr", "");
-        //cpu->describeCapability("pni", "");
-        //cpu->describeCapability("monitor", "");
-        //cpu->describeCapability("ds_cpl", "");
-        //cpu->describeCapability("est", "");
-        //cpu->describeCapability("tm2", "");
-        //cpu->describeCapability("cid", "");
-        //cpu->describeCapability("xtpr", "");
-        cpu->describeCapability("rng", "random number generator");
-        cpu->describeCapability("rng_en", "random number generator (enhanced)");
-        cpu->describeCapability("ace", "advanced cryptography engine");
-        cpu->describeCapability("ace_en", "advanced cryptography engine (enhanced)");
-        cpu->describeCapability("ht", "HyperThreading");
-        cpu->describeCapability("lm", "64bits extensions (x86-64)");
-        cpu->describeCapability("x86-64", "64bits extensions (x86-64)");
-        cpu->describeCapability("mmx", "multimedia extensions (MMX)");
-        cpu->describeCapability("pae", "4GB+ memory addressing (Physical Address Extension)");
-
-        if(cpu->isCapable("ia64") || cpu->isCapable("lm") || cpu->isCapable("x86-64"))
-            cpu->setWidth(64);
-
-        if(node.getWidth() == 0) node.setWidth(cpu->getWidth());
-    }
+    if(node.getWidth() == 0) node.setWidth(cpu->getWidth());
 }
 
+/*
+ * the file is split into one block per logical processor in a single pass;
+ * threads of the same package describe the same CPU, only the first block
+ * of each package is decoded
+ */
 bool scan_cpuinfo(hwNode & n)
 {
     hwNode *core = n.getChild("core");
@@ -203,35 +269,72 @@ bool scan_cpuinfo(hwNode & n)
 
     if(core)
     {
-        char buffer[1024];
-        size_t count;
+        char buffer[16384];
+        ssize_t count;
         string cpuinfo_str = "";
+        vector < cpuinfo_block > blocks;
+        vector < long > physids;
+        cpuinfo_field f;
+        const char *p = NULL;
+        const char *end = NULL;
+        bool physical = true;
+        int siblings = 0;
 
         while((count = read(cpuinfo, buffer, sizeof(buffer))) > 0)
         {
-            cpuinfo_str += string(buffer, count);
+            cpuinfo_str.append(buffer, count);
         }
         close(cpuinfo);
 
-        vector < string > cpuinfo_lines;
-        splitlines(cpuinfo_str, cpuinfo_lines);
-        cpuinfo_str = ""; // free memory
-        currentcpu = -1;
-
-        for(unsigned int i = 0; i < cpuinfo_lines.size(); i++)
+        p = cpuinfo_str.data();
+        end = p + cpuinfo_str.length();
+        while(next_field(p, end, f))
         {
-            string id = "";
-            string value = "";
-            size_t pos = 0;
-
-            pos = cpuinfo_lines[i].find(':');
-
-            if(pos != string::npos)
+            if(is(f, "processor") || blocks.empty())
             {
-                id = hw::strip(cpuinfo_lines[i].substr(0, pos));
-                value = hw::strip(cpuinfo_lines[i].substr(pos + 1));
-                cpuinfo_x86(n, id, value);
+                cpuinfo_block block;
+
+                if(!blocks.empty())
+                    blocks.back().end = f.line;
+                block.begin = f.line;
+                block.end = end;
+                block.physid = -1;
+                blocks.push_back(block);
             }
+            if(is(f, "physical id"))
+            {
+                blocks.back().physid = strtol(f.value, NULL, 10);
+                physids.push_back(blocks.back().physid);
+            }
+            if(is(f, "siblings") && (siblings <= 0))
+                siblings = strtol(f.value, NULL, 10);
+        }
+
+        for(unsigned int i = 0; i < blocks.size(); i++)
+            if(blocks[i].physid < 0)
+                physical = false;
+        sort(physids.begin(), physids.end());
+        physids.erase(unique(physids.begin(), physids.end()), physids.end());
+        if(siblings <= 0)
+            siblings = 1;
+
+        vector < bool > done;
+        for(unsigned int i = 0; i < blocks.size(); i++)
+        {
+            // packages are numbered by increasing physical id, like sysfs
+            unsigned int package = physical ?
+                lower_bound(physids.begin(), physids.end(), blocks[i].physid) - physids.begin() :
+                i / siblings;
+            hwNode *cpu = NULL;
+
+            if(package >= done.size())
+                done.resize(package + 1, false);
+            if(done[package])
+                continue;
+            done[package] = true;
+
+            if((cpu = getcpu(n, package)) != NULL)
+                cpuinfo_x86(n, cpu, blocks[i]);
         }
     }
     else
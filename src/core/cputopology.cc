@@ -0,0 +1,347 @@
+/*
+ * cputopology.cc
+ *
+ * This module builds the package/die/core/thread hierarchy of the CPUs
+ * from the topology directory of each /sys/devices/system/cpu/cpuN, with
+ * the caches from cache/indexN attached to the smallest level sharing them
+ *
+ */
+
+#include "cputopology.h"
+#include "osutils.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+#define SYSFS_CPU "/sys/devices/system/cpu"
+
+struct cpu_thread
+{
+    int cpu;
+    int package;
+    int die;
+    int core;
+    string numa;
+};
+
+struct cpu_cache
+{
+    int level;
+    string type;
+    unsigned long long size;
+    string ways;
+    string linesize;
+    string shared;
+    set < int > cpus;
+    bool attached;
+};
+
+static bool operator <(const cpu_thread & a, const cpu_thread & b)
+{
+    if(a.package != b.package)
+        return a.package < b.package;
+    if(a.die != b.die)
+        return a.die < b.die;
+    if(a.core != b.core)
+        return a.core < b.core;
+    return a.cpu < b.cpu;
+}
+
+static int get_int(const string & path, int def = 0)
+{
+    string value = get_string(path);
+
+    return (value == "") ? def : atoi(value.c_str());
+}
+
+// "0-3,8,10-11"
+static set < int > parse_cpulist(const string & list)
+{
+    set < int > result;
+    vector < string > ranges;
+
+    splitlines(list, ranges, ',');
+    for(unsigned int i = 0; i < ranges.size(); i++)
+    {
+        int first = 0, last = 0;
+
+        switch(sscanf(ranges[i].c_str(), "%d-%d", &first, &last))
+        {
+            case 1:
+                result.insert(first);
+                break;
+            case 2:
+                for(int cpu = first; cpu <= last; cpu++)
+                    result.insert(cpu);
+                break;
+        }
+    }
+
+    return result;
+}
+
+// "48K", "2048K", "32M"
+static unsigned long long parse_size(const string & size)
+{
+    unsigned long long result = strtoull(size.c_str(), NULL, 10);
+
+    if(size.find('K') != string::npos)
+        result *= 1024;
+    else if(size.find('M') != string::npos)
+        result *= 1024 * 1024;
+
+    return result;
+}
+
+static bool subset(const set < int > &a, const set < int > &b)
+{
+    return includes(b.begin(), b.end(), a.begin(), a.end());
+}
+
+static hwNode *getcpu(hwNode & node, int n)
+{
+    hwNode *cpu = node.findChildByBusInfo("cpu@" + tostring(n));
+    hwNode *core = node.getChild("core");
+
+    if(cpu)
+        return cpu;
+
+    if(!core)
+    {
+        node.addChild(hwNode("core", hw::bus));
+        core = node.getChild("core");
+    }
+    if(core)
+    {
+        hwNode newcpu("cpu", hw::processor);
+
+        newcpu.setBusInfo("cpu@" + tostring(n));
+        newcpu.addHint("icon", string("cpu"));
+        newcpu.claim();
+        return core->addChild(newcpu);
+    }
+
+    return NULL;
+}
+
+static void describe_cache(hwNode & cache, const cpu_cache & c)
+{
+    cache.setDescription("L" + tostring(c.level) + " cache");
+    if(c.size)
+        cache.setSize(c.size);
+    cache.setConfig("level", c.level);
+    if(c.type != "")
+        cache.setConfig("type", lowercase(c.type));
+    if(c.ways != "")
+        cache.setConfig("ways", c.ways);
+    if(c.linesize != "")
+        cache.setConfig("linesize", c.linesize);
+    if(c.shared != "")
+        cache.setConfig("cpus", c.shared);
+    cache.claim();
+}
+
+/*
+ * caches shared by exactly a subset of cpus, not claimed by a lower level;
+ * those shared by the whole package (package) are left to that level
+ */
+static void attach_caches(hwNode & node, const set < int > &cpus, vector < cpu_cache > &caches,
+    const set < int > *package = NULL)
+{
+    for(unsigned int i = 0; i < caches.size(); i++)
+    {
+        if(caches[i].attached || !subset(caches[i].cpus, cpus))
+            continue;
+        if(package && (caches[i].cpus == *package))
+            continue;
+
+        hwNode cache("cache", hw::memory);
+
+        describe_cache(cache, caches[i]);
+        node.addChild(cache);
+        caches[i].attached = true;
+    }
+}
+
+// package level caches may already have been reported by DMI
+static void attach_package_caches(hwNode & cpu, const set < int > &cpus, vector < cpu_cache > &caches)
+{
+    for(unsigned int i = 0; i < caches.size(); i++)
+    {
+        hwNode *existing = NULL;
+
+        if(caches[i].attached || !subset(caches[i].cpus, cpus))
+            continue;
+
+        for(unsigned int j = 0; j < cpu.countChildren(); j++)
+            if((cpu.getChild(j)->getClass() == hw::memory) &&
+                (cpu.getChild(j)->getDescription() == "L" + tostring(caches[i].level) + " cache") &&
+                (cpu.getChild(j)->getConfig("level") == ""))
+                existing = cpu.getChild(j);
+
+        if(existing)
+        {
+            describe_cache(*existing, caches[i]);
+            caches[i].attached = true;
+        }
+    }
+
+    attach_caches(cpu, cpus, caches);
+}
+
+static void scan_caches(int cpu, map < string, cpu_cache > &caches)
+{
+    string path = string(SYSFS_CPU) + "/cpu" + tostring(cpu) + "/cache";
+    vector < string > indexes = list_dir(path);
+
+    for(unsigned int i = 0; i < indexes.size(); i++)
+    {
+        string index = path + "/" + indexes[i];
+        cpu_cache cache;
+        string key;
+
+        if(indexes[i].compare(0, 5, "index") != 0)
+            continue;
+
+        cache.level = get_int(index + "/level");
+        cache.type = get_string(index + "/type");
+        cache.size = parse_size(get_string(index + "/size"));
+        cache.ways = get_string(index + "/ways_of_associativity");
+        cache.linesize = get_string(index + "/coherency_line_size");
+        cache.shared = get_string(index + "/shared_cpu_list", tostring(cpu));
+        cache.cpus = parse_cpulist(cache.shared);
+        cache.attached = false;
+
+        // the same cache is listed by every cpu sharing it
+        key = tostring(cache.level) + ":" + cache.type + ":" + cache.shared;
+        if(caches.find(key) == caches.end())
+            caches[key] = cache;
+    }
+}
+
+// the NUMA node of a cpu, from its "node<N>" link: empty without NUMA
+static string numa_node(const string & cpu)
+{
+    vector < string > entries = list_dir(cpu);
+
+    for(unsigned int i = 0; i < entries.size(); i++)
+    {
+        int node = -1;
+
+        if((sscanf(entries[i].c_str(), "node%d", &node) == 1) && (entries[i] == "node" + tostring(node)))
+            return tostring(node);
+    }
+
+    return "";
+}
+
+bool scan_cputopology(hwNode & n)
+{
+    vector < string > entries = list_dir(SYSFS_CPU);
+    vector < cpu_thread > threads;
+    map < string, cpu_cache > cachemap;
+    vector < cpu_cache > caches;
+    int packages = 0;
+
+    for(unsigned int i = 0; i < entries.size(); i++)
+    {
+        string topology = string(SYSFS_CPU) + "/" + entries[i] + "/topology";
+        cpu_thread thread;
+
+        // offline cpus have no topology directory
+        if((sscanf(entries[i].c_str(), "cpu%d", &thread.cpu) != 1) || !exists(topology))
+            continue;
+
+        thread.package = get_int(topology + "/physical_package_id");
+        thread.die = get_int(topology + "/die_id");
+        thread.core = get_int(topology + "/core_id", thread.cpu);
+        thread.numa = numa_node(string(SYSFS_CPU) + "/" + entries[i]);
+
+        threads.push_back(thread);
+        scan_caches(thread.cpu, cachemap);
+    }
+
+    if(threads.size() == 0)
+        return false;
+
+    sort(threads.begin(), threads.end());
+    for(map < string, cpu_cache >::iterator i = cachemap.begin(); i != cachemap.end(); i++)
+        caches.push_back(i->second);
+
+    // nodes are built bottom-up: addChild() copies them
+    for(unsigned int p = 0; p < threads.size(); packages++)
+    {
+        hwNode *cpu = getcpu(n, packages);
+        set < int > packagecpus;
+        int cores = 0;
+        unsigned int first = p;
+
+        // with a single die (or core), the die has the same cpus as the package
+        for(unsigned int t = p; (t < threads.size()) && (threads[t].package == threads[first].package); t++)
+            packagecpus.insert(threads[t].cpu);
+
+        while((p < threads.size()) && (threads[p].package == threads[first].package))
+        {
+            hwNode die("die", hw::processor);
+            set < int > diecpus;
+            unsigned int dfirst = p;
+
+            die.setDescription("CPU die");
+            die.setPhysId(threads[p].die);
+            while((p < threads.size()) && (threads[p].package == threads[dfirst].package) &&
+                (threads[p].die == threads[dfirst].die))
+            {
+                hwNode core("core", hw::processor);
+                set < int > corecpus;
+                unsigned int cfirst = p;
+
+                core.setDescription("CPU core");
+                core.setPhysId(threads[p].core);
+                while((p < threads.size()) && (threads[p].package == threads[cfirst].package) &&
+                    (threads[p].die == threads[cfirst].die) && (threads[p].core == threads[cfirst].core))
+                {
+                    hwNode thread("thread", hw::processor);
+
+                    thread.setDescription("CPU thread");
+                    thread.setPhysId(threads[p].cpu);
+                    thread.setConfig("cpu", threads[p].cpu);
+                    if(threads[p].numa != "")
+                        thread.setConfig("numa_node", threads[p].numa);
+                    thread.claim();
+                    core.addChild(thread);
+                    corecpus.insert(threads[p].cpu);
+                    p++;
+                }
+
+                attach_caches(core, corecpus, caches, &packagecpus);
+                core.setConfig("threads", corecpus.size());
+                core.claim();
+                die.addChild(core);
+                diecpus.insert(corecpus.begin(), corecpus.end());
+                cores++;
+            }
+
+            attach_caches(die, diecpus, caches, &packagecpus);
+            die.claim();
+            if(cpu)
+                cpu->addChild(die);
+        }
+
+        if(!cpu)
+            continue;
+
+        attach_package_caches(*cpu, packagecpus, caches);
+        if(cpu->getConfig("cores") == "")
+            cpu->setConfig("cores", cores);
+        if(cpu->getConfig("threads") == "")
+            cpu->setConfig("threads", packagecpus.size());
+        cpu->claim();
+    }
+
+    return true;
+}
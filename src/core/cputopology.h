@@ -0,0 +1,7 @@
+#ifndef _CPUTOPOLOGY_H_
+#define _CPUTOPOLOGY_H_
+
+#include "hw.h"
+
+bool scan_cputopology(hwNode & n);
+#endif
@@ -1,11 +1,13 @@
 #include "disk.h"
 #include "osutils.h"
 #include "heuristics.h"
+#include "options.h"
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <sys/ioctl.h>
 #include <fcntl.h>
 #include <unistd.h>
+#include <stdlib.h>
 
 //#include <linux/fs.h>
 
@@ -26,16 +28,102 @@
 #define BLKPBSZGET _IO(0x12,123)
 #endif
 
-bool scan_disk(hwNode & n)
+#define SYSFS_BLOCK "/sys/block"
+
+// "/dev/sda" -> "sda", "/dev/cciss/c0d0" -> "cciss!c0d0"
+static string sysfs_blockname(const string & logicalname)
+{
+    string name = logicalname;
+
+    if(name.compare(0, 5, "/dev/") == 0)
+        name = name.substr(5);
+    for(unsigned int i = 0; i < name.length(); i++)
+        if(name[i] == '/')
+            name[i] = '!';
+
+    return name;
+}
+
+// "none [mq-deadline] kyber" -> "mq-deadline"
+static string active_scheduler(const string & schedulers)
+{
+    size_t start = schedulers.find('[');
+    size_t end = schedulers.find(']');
+
+    if((start == string::npos) || (end == string::npos) || (end < start))
+        return schedulers;
+
+    return schedulers.substr(start + 1, end - start - 1);
+}
+
+static void queue_setting(hwNode & n, const string & queue, const string & attribute, bool nonzero = false)
+{
+    string value = get_string(queue + "/" + attribute);
+
+    if(value == "" || (nonzero && value == "0"))
+        return;
+    n.setConfig(attribute, value);
+}
+
+/*
+ * size, sector sizes and the block layer queue settings from
+ * /sys/block/<name>, returns false if the device has no sysfs entry
+ */
+static bool scan_sysfs_block(hwNode & n)
+{
+    string path = string(SYSFS_BLOCK) + "/" + sysfs_blockname(n.getLogicalName());
+    string queue = path + "/queue";
+    string physical, logical, scheduler, rotational;
+    unsigned long long sectors = 0;
+    unsigned long hctx = 0;
+
+    if(!exists(queue))
+        return false;
+
+    if(n.getSize() == 0)
+    {
+        sectors = strtoull(get_string(path + "/size", "0").c_str(), NULL, 10);
+        if(sectors > 0)
+            n.setSize(sectors * 512);             // always 512-byte units
+    }
+    physical = get_string(queue + "/physical_block_size");
+    if(physical != "")
+        n.setConfig("sectorsize", physical);
+    logical = get_string(queue + "/logical_block_size");
+    if(logical != "")
+        n.setConfig("logicalsectorsize", logical);
+
+    scheduler = get_string(queue + "/scheduler");
+    if(scheduler != "")
+        n.setConfig("scheduler", active_scheduler(scheduler));
+    rotational = get_string(queue + "/rotational");
+    if(rotational != "")
+        n.setConfig("rotational", rotational == "0" ? "no" : "yes");
+    queue_setting(n, queue, "nr_requests");
+    queue_setting(n, queue, "max_hw_sectors_kb");
+    queue_setting(n, queue, "optimal_io_size", true);
+    queue_setting(n, queue, "discard_granularity", true);
+    queue_setting(n, queue, "write_cache");
+
+    hctx = list_dir(path + "/mq").size();
+    if(hctx > 0)
+        n.setConfig("hw_queues", hctx);
+
+    return true;
+}
+
+/*
+ * the ioctls need the device to be opened, which spins up sleeping disks
+ * and needs root: only done when sysfs doesn't know the device, never
+ * when the "disk:open" test is disabled
+ */
+static bool scan_blockdevice(hwNode & n)
 {
     long size = 0;
     unsigned long long bytes = 0;
     int sectsize = 0;
     int physsectsize = 0;
 
-    if(n.getLogicalName() == "")
-        return false;
-
     int fd = open(n.getLogicalName().c_str(), O_RDONLY | O_NONBLOCK);
 
     if(fd < 0)
@@ -68,3 +156,17 @@ bool scan_disk(hwNode & n)
 
     return true;
 }
+
+bool scan_disk(hwNode & n)
+{
+    bool sysfs = false;
+
+    if(n.getLogicalName() == "")
+        return false;
+
+    sysfs = scan_sysfs_block(n);
+    if((!sysfs || n.getSize() == 0) && enabled(OPT_DISK_OPEN))
+        return scan_blockdevice(n) || sysfs;
+
+    return sysfs;
+}
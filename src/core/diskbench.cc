@@ -0,0 +1,482 @@
+/*
+ * diskbench.cc
+ *
+ * O_DIRECT disk benchmark: sequential and random reads and writes at a
+ * given queue depth, submitted through io_uring when the kernel has it
+ * and through one pread/pwrite thread per queue slot otherwise.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#include <omp.h>
+#include <vector>
+#include <algorithm>
+#include "diskbench.h"
+
+#ifndef BLKGETSIZE64
+#define BLKGETSIZE64 _IOR(0x12,114,size_t)
+#endif
+
+#define ALIGNMENT 4096
+
+struct job
+{
+    int fd;
+    bool write;
+    bool random;
+    int blocksize;
+    long long span;     // bytes addressed, multiple of blocksize
+    double seconds;
+};
+
+static double now()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static long long next_offset(const job & j, long long & cursor, unsigned int & seed)
+{
+    long long blocks = j.span / j.blocksize;
+    long long offset;
+
+    if(j.random)
+        return (((long long) rand_r(&seed) << 31 | rand_r(&seed)) % blocks) * j.blocksize;
+
+    offset = cursor;
+    cursor += j.blocksize;
+    if(cursor >= j.span)
+        cursor = 0;
+
+    return offset;
+}
+
+static void *alloc_buffer(int blocksize)
+{
+    void *buf = NULL;
+
+    if(posix_memalign(&buf, ALIGNMENT, blocksize) != 0)
+        return NULL;
+    memset(buf, 0x5a, blocksize);
+
+    return buf;
+}
+
+/*
+ * io_uring, driven through the raw system calls
+ */
+
+struct uring
+{
+    int fd;
+    unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+    unsigned *cq_head, *cq_tail, *cq_mask;
+    struct io_uring_sqe *sqes;
+    struct io_uring_cqe *cqes;
+    void *sq_ptr, *cq_ptr;
+    size_t sq_len, cq_len, sqes_len;
+};
+
+static bool uring_open(uring & r, unsigned entries)
+{
+#ifdef __NR_io_uring_setup
+    struct io_uring_params p;
+
+    memset(&r, 0, sizeof(r));
+    memset(&p, 0, sizeof(p));
+    r.fd = syscall(__NR_io_uring_setup, entries, &p);
+    if(r.fd < 0)
+        return false;
+
+    r.sq_len = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    r.cq_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    r.sqes_len = p.sq_entries * sizeof(struct io_uring_sqe);
+
+    r.sq_ptr = mmap(NULL, r.sq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, r.fd, IORING_OFF_SQ_RING);
+    r.cq_ptr = mmap(NULL, r.cq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, r.fd, IORING_OFF_CQ_RING);
+    r.sqes = (struct io_uring_sqe *) mmap(NULL, r.sqes_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, r.fd, IORING_OFF_SQES);
+    if(r.sq_ptr == MAP_FAILED || r.cq_ptr == MAP_FAILED || r.sqes == MAP_FAILED)
+    {
+        if(r.sq_ptr != MAP_FAILED) munmap(r.sq_ptr, r.sq_len);
+        if(r.cq_ptr != MAP_FAILED) munmap(r.cq_ptr, r.cq_len);
+        if(r.sqes != MAP_FAILED) munmap(r.sqes, r.sqes_len);
+        close(r.fd);
+        return false;
+    }
+
+    r.sq_head = (unsigned *) ((char *) r.sq_ptr + p.sq_off.head);
+    r.sq_tail = (unsigned *) ((char *) r.sq_ptr + p.sq_off.tail);
+    r.sq_mask = (unsigned *) ((char *) r.sq_ptr + p.sq_off.ring_mask);
+    r.sq_array = (unsigned *) ((char *) r.sq_ptr + p.sq_off.array);
+    r.cq_head = (unsigned *) ((char *) r.cq_ptr + p.cq_off.head);
+    r.cq_tail = (unsigned *) ((char *) r.cq_ptr + p.cq_off.tail);
+    r.cq_mask = (unsigned *) ((char *) r.cq_ptr + p.cq_off.ring_mask);
+    r.cqes = (struct io_uring_cqe *) ((char *) r.cq_ptr + p.cq_off.cqes);
+
+    return true;
+#else
+    return false;
+#endif
+}
+
+static void uring_close(uring & r)
+{
+    munmap(r.sqes, r.sqes_len);
+    munmap(r.cq_ptr, r.cq_len);
+    munmap(r.sq_ptr, r.sq_len);
+    close(r.fd);
+}
+
+static void uring_queue(uring & r, const job & j, void *buf, long long offset, unsigned slot)
+{
+    unsigned tail = *r.sq_tail;
+    unsigned index = tail & *r.sq_mask;
+    struct io_uring_sqe *sqe = &r.sqes[index];
+
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = j.write ? IORING_OP_WRITE : IORING_OP_READ;
+    sqe->fd = j.fd;
+    sqe->addr = (unsigned long) buf;
+    sqe->len = j.blocksize;
+    sqe->off = offset;
+    sqe->user_data = slot;
+    r.sq_array[index] = index;
+
+    __atomic_store_n(r.sq_tail, tail + 1, __ATOMIC_RELEASE);
+}
+
+static bool run_uring(const job & j, int depth, vector < double > & latencies, unsigned long long & ios)
+{
+    uring r;
+    vector < void *> buffers(depth, (void *) NULL);
+    vector < double > issued(depth, 0.0);
+    unsigned int seed = getpid();
+    long long cursor = 0;
+    unsigned pending = 0, inflight = 0;
+    double deadline;
+    bool ok = true;
+
+    if(!uring_open(r, depth))
+        return false;
+
+    for(int i = 0; i < depth; i++)
+        if(!(buffers[i] = alloc_buffer(j.blocksize)))
+            ok = false;
+
+    deadline = now() + j.seconds;
+    for(int i = 0; ok && i < depth; i++)
+    {
+        issued[i] = now();
+        uring_queue(r, j, buffers[i], next_offset(j, cursor, seed), i);
+        pending++;
+        inflight++;
+    }
+
+    while(ok && inflight > 0)
+    {
+        unsigned head;
+
+        if(syscall(__NR_io_uring_enter, r.fd, pending, 1, IORING_ENTER_GETEVENTS, NULL, 0) < 0)
+        {
+            if(errno == EINTR)
+                continue;
+            ok = false;
+            break;
+        }
+        pending = 0;
+
+        head = *r.cq_head;
+        while(head != __atomic_load_n(r.cq_tail, __ATOMIC_ACQUIRE))
+        {
+            struct io_uring_cqe *cqe = &r.cqes[head & *r.cq_mask];
+            unsigned slot = cqe->user_data;
+            double t = now();
+
+            head++;
+            inflight--;
+            if(cqe->res != j.blocksize)
+            {
+                // the first failure is usually EINVAL from an engine
+                // that cannot do this operation, let the caller fall back
+                ok = (ios > 0);
+                continue;
+            }
+
+            latencies.push_back((t - issued[slot]) * 1e6);
+            ios++;
+
+            if(t < deadline)
+            {
+                issued[slot] = t;
+                uring_queue(r, j, buffers[slot], next_offset(j, cursor, seed), slot);
+                pending++;
+                inflight++;
+            }
+        }
+        __atomic_store_n(r.cq_head, head, __ATOMIC_RELEASE);
+    }
+
+    /*
+     * tearing the ring down doesn't wait for the requests still in flight
+     * after a failure: reap them before their buffers are freed, and leak
+     * the buffers if the kernel can't be asked anymore
+     */
+    while(inflight > 0)
+    {
+        unsigned head;
+
+        if(syscall(__NR_io_uring_enter, r.fd, pending, 1, IORING_ENTER_GETEVENTS, NULL, 0) < 0)
+        {
+            if(errno == EINTR)
+                continue;
+            break;
+        }
+        pending = 0;
+
+        head = *r.cq_head;
+        while(head != __atomic_load_n(r.cq_tail, __ATOMIC_ACQUIRE))
+        {
+            head++;
+            inflight--;
+        }
+        __atomic_store_n(r.cq_head, head, __ATOMIC_RELEASE);
+    }
+
+    uring_close(r);
+    for(int i = 0; inflight == 0 && i < depth; i++)
+        free(buffers[i]);
+
+    return ok;
+}
+
+/*
+ * fallback: one synchronous pread/pwrite thread per queue slot
+ */
+
+static bool run_threads(const job & j, int depth, vector < double > & latencies, unsigned long long & ios)
+{
+    double deadline = now() + j.seconds;
+    bool ok = true;
+
+#pragma omp parallel num_threads(depth) reduction(+:ios)
+    {
+        vector < double > local;
+        void *buf = alloc_buffer(j.blocksize);
+        unsigned int seed = getpid() + omp_get_thread_num();
+        long long cursor = (j.span / depth / j.blocksize) * j.blocksize * omp_get_thread_num();
+        double t = now();
+
+        while(buf && t < deadline)
+        {
+            long long offset = next_offset(j, cursor, seed);
+            ssize_t n;
+
+            n = j.write ? pwrite(j.fd, buf, j.blocksize, offset) : pread(j.fd, buf, j.blocksize, offset);
+            if(n != j.blocksize)
+            {
+#pragma omp atomic write
+                ok = false;
+                break;
+            }
+            local.push_back((now() - t) * 1e6);
+            ios++;
+            t = now();
+        }
+        free(buf);
+
+#pragma omp critical
+        latencies.insert(latencies.end(), local.begin(), local.end());
+    }
+
+    return ok;
+}
+
+static double percentile(vector < double > & v, double p)
+{
+    size_t k;
+
+    if(v.empty())
+        return 0;
+
+    k = (size_t) (p * (v.size() - 1));
+    nth_element(v.begin(), v.begin() + k, v.end());
+
+    return v[k];
+}
+
+// lay out a test file like sysbench "prepare" so reads hit real blocks
+static bool fill_file(int fd, long long size, int blocksize)
+{
+    void *buf = alloc_buffer(blocksize);
+    long long offset;
+
+    if(!buf)
+        return false;
+
+    for(offset = 0; offset < size; offset += blocksize)
+        if(pwrite(fd, buf, blocksize, offset) != blocksize)
+            break;
+    free(buf);
+    fsync(fd);
+
+    return offset >= size;
+}
+
+// O_DIRECT when the file system has it (not tmpfs and friends), direct tells
+static int open_direct(const char *name, int flags, bool & direct)
+{
+    int fd = open(name, flags | O_DIRECT);
+
+    direct = (fd >= 0);
+    if(fd < 0 && errno == EINVAL)
+        fd = open(name, flags);
+    return fd;
+}
+
+disk_result disk_bench(const string & path, const string & test,
+        int depth, int blocksize, long long size, double seconds)
+{
+    disk_result result = {0, 0, 0, 0, 0, "", false};
+    vector < double > latencies;
+    unsigned long long ios = 0;
+    struct stat buf;
+    char tmpname[PATH_MAX];
+    bool temporary = false;
+    double start, elapsed;
+    job j;
+
+    if(depth <= 0 || blocksize <= 0 || blocksize % 512 != 0 || seconds <= 0)
+        return result;
+    if(stat(path.c_str(), &buf) != 0)
+        return result;
+
+    j.write = (test == "seqwrite" || test == "randwrite");
+    j.random = (test == "randread" || test == "randwrite");
+    j.blocksize = blocksize;
+    j.seconds = seconds;
+    if(!j.write && test != "seqread" && test != "randread")
+        return result;
+
+    if(S_ISBLK(buf.st_mode))
+    {
+        unsigned long long bytes = 0;
+
+        // never write to a raw device, it would destroy its content
+        if(j.write)
+            return result;
+
+        j.fd = open(path.c_str(), O_RDONLY | O_DIRECT);
+        if(j.fd < 0)
+            return result;
+        result.direct = true;
+        if(ioctl(j.fd, BLKGETSIZE64, &bytes) != 0)
+            bytes = 0;
+        j.span = (size > 0 && (unsigned long long) size < bytes) ? size : bytes;
+    }
+    else if(S_ISDIR(buf.st_mode))
+    {
+        int fd;
+
+        if(size <= 0)
+            return result;
+
+        snprintf(tmpname, sizeof(tmpname), "%s/ydm-diskbench-XXXXXX", path.c_str());
+        fd = mkstemp(tmpname);
+        if(fd < 0)
+            return result;
+        temporary = true;
+
+        if(!fill_file(fd, size, blocksize))
+        {
+            close(fd);
+            unlink(tmpname);
+            return result;
+        }
+        close(fd);
+
+        j.fd = open_direct(tmpname, O_RDWR, result.direct);
+        j.span = size;
+    }
+    else if(S_ISREG(buf.st_mode))
+    {
+        int fd;
+
+        if(size <= 0)
+            return result;
+
+        /*
+         * an empty file is laid out and can then be shared by the next
+         * tests; a file with content is someone's data: read tests only
+         */
+        if(buf.st_size == 0)
+        {
+            fd = open(path.c_str(), O_RDWR);
+            if(fd < 0)
+                return result;
+            if(!fill_file(fd, size, blocksize))
+            {
+                close(fd);
+                return result;
+            }
+            close(fd);
+            j.span = size;
+        }
+        else if(j.write)
+            return result;
+        else
+            j.span = (buf.st_size < size) ? buf.st_size : size;
+
+        j.fd = open_direct(path.c_str(), j.write ? O_RDWR : O_RDONLY, result.direct);
+    }
+    else
+        return result;
+
+    if(j.fd >= 0)
+    {
+        j.span -= j.span % blocksize;
+
+        if(j.span >= blocksize)
+        {
+            start = now();
+            if(run_uring(j, depth, latencies, ios))
+                result.engine = "io_uring";
+            else
+            {
+                latencies.clear();
+                ios = 0;
+                start = now();
+                if(run_threads(j, depth, latencies, ios))
+                    result.engine = "pread";
+            }
+            elapsed = now() - start;
+
+            if(result.engine != "" && elapsed > 0)
+            {
+                result.iops = ios / elapsed;
+                result.bandwidth = result.iops * blocksize;
+                result.lat_p50 = percentile(latencies, 0.50);
+                result.lat_p95 = percentile(latencies, 0.95);
+                result.lat_p99 = percentile(latencies, 0.99);
+            }
+        }
+        close(j.fd);
+    }
+
+    if(temporary)
+        unlink(tmpname);
+
+    return result;
+}
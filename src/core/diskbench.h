@@ -0,0 +1,27 @@
+#ifndef _DISKBENCH_H_
+#define _DISKBENCH_H_
+
+#include <string>
+
+using namespace std;
+
+struct disk_result {
+    double bandwidth;   // bytes per second
+    double iops;
+    double lat_p50;     // completion latency percentiles, microseconds
+    double lat_p95;
+    double lat_p99;
+    string engine;      // "io_uring" or "pread", empty on error
+    bool direct;        // false if the file system refused O_DIRECT: the page cache was measured
+};
+
+/*
+ * test is one of "seqread", "seqwrite", "randread", "randwrite".
+ * path may be a block device (read tests only), a directory, in which
+ * case a temporary file of the given size is laid out and removed, or a
+ * regular file: an empty one is laid out to the given size and kept so
+ * that several tests can share it, one with content is only read.
+ */
+disk_result disk_bench(const string & path, const string & test,
+        int depth, int blocksize, long long size, double seconds);
+#endif
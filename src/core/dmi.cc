@@ -1,6 +1,7 @@
 #include "options.h"
 #include "dmi.h"
 #include "osutils.h"
+#include "scancontext.h"
 
 #include <map>
 #include <vector>
@@ -11,9 +12,9 @@
 #include <string.h>
 #include <stdlib.h>
 #include <sys/mman.h>
+#include <errno.h>
 
 
-static int currentcpu = 0;
 
 typedef unsigned char u8;
 typedef unsigned short u16;
@@ -102,9 +103,7 @@ static string dmi_uuid(u8 * p)
     if(!valid)
         return "";
 
-    if(::enabled("output:sanitize"))
-        return string(REMOVED);
-
+    // removed when printed (hwNode::asXML()), the decoded tree is cached
     snprintf(buffer, sizeof(buffer),
             "%02X%02X%02X%02X-%02X%02X-%02X%02X-%02X%02X-%02X%02X%02X%02X%02X%02X",
             p[0], p[1], p[2], p[3], p[4], p[5], p[6], p[7], p[8], p[9], p[10],
@@ -823,43 +822,30 @@ static string dmi_handle(u16 handle)
     return string(buffer);
 }
 
-static void dmi_table(int fd,
-        u32 base,
-        int len,
+/*
+ * decodes the structure table in place; num is the number of structures
+ * announced by a 32-bit entry point, 0 when the table comes from a SMBIOS 3
+ * entry point, whose length is only an upper bound: decoding then stops at
+ * the End-of-Table structure
+ */
+static void dmi_table(const u8 * table,
+        u32 len,
         int num,
         hwNode & node,
         int dmiversionmaj,
         int dmiversionmin)
 {
-    unsigned char *buf = (unsigned char *) malloc(len);
+    u8 *buf = (u8 *) table;
     struct dmi_header *dm;
     hwNode *hardwarenode = NULL;
     u8 *data;
     int i = 0;
     string handle;
-    u32 mmoffset = 0;
-    void *mmp = NULL;
 
-    if(len == 0)
+    if(len == 0 || buf == NULL)
         // no data
         return;
 
-    if(buf == NULL)
-        // memory exhausted
-        return;
-
-    mmoffset = base % getpagesize();
-
-    mmp = mmap(0, mmoffset + len, PROT_READ, MAP_SHARED, fd, base - mmoffset);
-    if(mmp == MAP_FAILED)
-    {
-        free(buf);
-        return;
-    }
-    memcpy(buf, (u8 *) mmp + mmoffset, len);
-
-    munmap(mmp, mmoffset + len);
-
     data = buf;
     while(data + sizeof(struct dmi_header) <= (u8 *) buf + len)
     {
@@ -1000,7 +986,7 @@ static void dmi_table(int fd,
                         hw::processor);
 
                 newnode.claim();
-                newnode.setBusInfo(cpubusinfo(currentcpu++));
+                newnode.setBusInfo(cpubusinfo(scan_context().currentcpu++));
                 newnode.setSlot(dmi_string(dm, data[4]));
                 newnode.setDescription("CPU");
                 newnode.addHint("icon", string("cpu"));
@@ -1597,18 +1583,227 @@ static void dmi_table(int fd,
             default:
                 break;
         }
+        if((num == 0) && (dm->type == 127))
+            break;
         data += dm->length;
-        while(*data || data[1])
+        while((data + 1 < (u8 *) buf + len) && (*data || data[1]))
             data++;
         data += 2;
         i++;
     }
-    free(buf);
 }
 
+#define SYSFS_DMI "/sys/firmware/dmi/tables"
+#define BIOS_WINDOW 0xE0000L                      /* legacy entry point search area */
+#define BIOS_WINDOW_SIZE 0x20000L
+#define DMI_CACHE "/run/lshw-dmi.cache"           /* cleared on reboot */
+
+struct smbios_entry
+{
+    unsigned long long base;
+    u32 len;
+    u16 num;
+    u8 smmajver, smminver;
+    u16 dmimaj, dmimin;
+    u8 checksum;
+};
+
+static u32 le32(const u8 * p)
+{
+    return p[0] | p[1] << 8 | p[2] << 16 | (u32) p[3] << 24;
+}
+
+/*
+ * parses a SMBIOS 3 ("_SM3_"), SMBIOS 2 ("_SM_") or legacy DMI ("_DMI_")
+ * entry point, len is the number of bytes readable at buf
+ */
+static bool smbios_entry_point(const u8 * buf, size_t len, smbios_entry & entry)
+{
+    memset(&entry, 0, sizeof(entry));
+
+    if((len >= 0x18) && (memcmp(buf, "_SM3_", 5) == 0))
+    {
+        if((buf[6] < 0x18) || (buf[6] > len) || !checksum(buf, buf[6]))
+            return false;
+        entry.checksum = buf[5];
+        entry.smmajver = entry.dmimaj = buf[7];
+        entry.smminver = entry.dmimin = buf[8];
+        entry.len = le32(buf + 12);               // maximum size
+        entry.base = le32(buf + 16) | (unsigned long long) le32(buf + 20) << 32;
+        return true;
+    }
+
+    if((len >= 0x1F) && (memcmp(buf, "_SM_", 4) == 0))
+    {
+        entry.smmajver = buf[6];
+        entry.smminver = buf[7];
+        // the intermediate anchor follows
+        buf += 16;
+        len -= 16;
+    }
+
+    if((len >= 0x0F) && (memcmp(buf, "_DMI_", 5) == 0) && checksum(buf, 0x0F))
+    {
+        entry.checksum = buf[5];
+        entry.num = buf[13] << 8 | buf[12];
+        entry.len = buf[7] << 8 | buf[6];
+        entry.base = le32(buf + 8);
+        entry.dmimaj = buf[14] ? buf[14] >> 4 : entry.smmajver;
+        entry.dmimin = buf[14] ? buf[14] & 0x0F : entry.smminver;
+        return true;
+    }
+
+    return false;
+}
+
+static bool read_binary(const string & path, vector < u8 > &data)
+{
+    u8 buffer[4096];
+    ssize_t count = 0;
+    int fd = open(path.c_str(), O_RDONLY);
+
+    data.clear();
+    if(fd < 0)
+        return false;
+
+    while((count = read(fd, buffer, sizeof(buffer))) > 0)
+        data.insert(data.end(), buffer, buffer + count);
+
+    close(fd);
+    return (count == 0) && (data.size() > 0);
+}
+
+static string cachefile = DMI_CACHE;
+
+void dmi_cache_file(const string & path)
+{
+    cachefile = path;
+}
+
+bool dmi_cache_invalidate()
+{
+    return (cachefile != "") && ((unlink(cachefile.c_str()) == 0) || (errno == ENOENT));
+}
+
+// entry point checksum and FNV-1a hash of the structure table
+static string dmi_cache_key(const smbios_entry & entry, const u8 * table, u32 len)
+{
+    unsigned long long hash = 0xcbf29ce484222325ULL;
+    char buffer[40];
+
+    for(u32 i = 0; i < len; i++)
+        hash = (hash ^ table[i]) * 0x100000001b3ULL;
+    snprintf(buffer, sizeof(buffer), "%02x-%08x-%016llx", entry.checksum, len, hash);
+
+    return string(buffer);
+}
+
+static bool dmi_cache_load(const string & key, hwNode & n)
+{
+    vector < u8 > data;
+    string content;
+    size_t eol = 0;
+
+    if((cachefile == "") || !enabled(OPT_DMI_CACHE) || !read_binary(cachefile, data))
+        return false;
+
+    content = string(data.begin(), data.end());
+    eol = content.find('\n');
+    if((eol == string::npos) || (content.substr(0, eol) != "lshw-dmi " + key))
+        return false;
+
+    return n.unserialize(content.substr(eol + 1));
+}
+
+// the tables can contain serial numbers: only readable by the owner
+static void dmi_cache_save(const string & key, const hwNode & n)
+{
+    string content = "lshw-dmi " + key + "\n" + n.serialize();
+    string tmpfile = "";
+    vector < char > name;
+    int fd = -1;
+
+    if((cachefile == "") || !enabled(OPT_DMI_CACHE))
+        return;
+
+    // mkstemp() creates it 0600, and a file of its own for each concurrent scan
+    tmpfile = cachefile + ".XXXXXX";
+    name.assign(tmpfile.begin(), tmpfile.end());
+    name.push_back('\0');
+    fd = mkstemp(&name[0]);
+    if(fd < 0)
+        return;
+    tmpfile = &name[0];
+    if(write(fd, content.c_str(), content.length()) != (ssize_t) content.length())
+    {
+        close(fd);
+        unlink(tmpfile.c_str());
+        return;
+    }
+    close(fd);
+    if(rename(tmpfile.c_str(), cachefile.c_str()) != 0)
+        unlink(tmpfile.c_str());
+}
+
+// adds what the DMI decoder found to the tree
+static void dmi_graft(hwNode & n, hwNode & decoded)
+{
+    n.merge(decoded);
+    for(unsigned int i = 0; i < decoded.countChildren(); i++)
+    {
+        hwNode *child = decoded.getChild(i);
+        hwNode *existing = n.getChild(child->getId());
+
+        if(existing)
+            dmi_graft(*existing, *child);
+        else
+            n.addChild(*child);
+    }
+}
+
+/*
+ * decoding is done on an empty node so the result only depends on the
+ * tables and can be reused by the next scan
+ */
+static void dmi_decode(hwNode & n, const smbios_entry & entry, const u8 * table, u32 len)
+{
+    hwNode decoded(n.getId(), n.getClass());
+    string key = dmi_cache_key(entry, table, len);
+
+    if(!dmi_cache_load(key, decoded))
+    {
+        decoded = hwNode(n.getId(), n.getClass());
+        dmi_table(table, len, entry.num, decoded, entry.dmimaj, entry.dmimin);
+        dmi_cache_save(key, decoded);
+    }
+
+    dmi_graft(n, decoded);
+}
+
+// maps len bytes of physical memory at base, the mapping is page-aligned
+static u8 *map_physical(int fd, unsigned long long base, size_t len)
+{
+    size_t mmoffset = base % getpagesize();
+    void *mmp = mmap(0, mmoffset + len, PROT_READ, MAP_SHARED, fd, base - mmoffset);
+
+    if(mmp == MAP_FAILED)
+        return NULL;
+
+    return (u8 *) mmp + mmoffset;
+}
+
+static void unmap_physical(u8 * p, size_t len)
+{
+    size_t mmoffset = (unsigned long) p % getpagesize();
+
+    munmap(p - mmoffset, mmoffset + len);
+}
+
+// SMBIOS3 if the firmware publishes both entry points
 long get_efi_systab_smbios()
 {
     long result = 0;
+    long smbios3 = 0;
     vector < string > sysvars;
 
     if(loadfile("/sys/firmware/efi/systab", sysvars) || loadfile("/proc/efi/systab", sysvars))
@@ -1622,87 +1817,99 @@ long get_efi_systab_smbios()
             {
                 sscanf(variable[1].c_str(), "%lx", &result);
             }
+            if((variable[0] == "SMBIOS3") && (variable.size() == 2))
+            {
+                sscanf(variable[1].c_str(), "%lx", &smbios3);
+            }
         }
 
-    return result;
+    return smbios3 ? smbios3 : result;
 }
 
-bool scan_dmi(hwNode & n)
+// entry point and table exported by the kernel, no /dev/mem access needed
+static bool scan_dmi_sysfs(hwNode & n, smbios_entry & entry)
 {
-    unsigned char buf[20];
-    int fd = open("/dev/mem",
-            O_RDONLY);
-    long fp = get_efi_systab_smbios();
-    u32 mmoffset = 0;
-    void *mmp = NULL;
-    bool efi = true;
-    u8 smmajver = 0, smminver = 0;
-    u16 dmimaj = 0, dmimin = 0;
-    currentcpu = 0;
-
-#ifdef __hppa__
-    return false; // SMBIOS not supported on PA-RISC machines
-#endif
+    vector < u8 > ep, table;
 
-    if(sizeof(u8) != 1 || sizeof(u16) != 2 || sizeof(u32) != 4)
-        // compiler incompatibility
+    if(!read_binary(SYSFS_DMI "/smbios_entry_point", ep) ||
+        !smbios_entry_point(&ep[0], ep.size(), entry))
         return false;
+    if(!read_binary(SYSFS_DMI "/DMI", table))
+        return false;
+
+    if((entry.len == 0) || (entry.len > table.size()))
+        entry.len = table.size();
+    dmi_decode(n, entry, &table[0], entry.len);
+
+    return true;
+}
+
+static bool scan_dmi_devmem(hwNode & n, smbios_entry & entry)
+{
+    int fd = open("/dev/mem", O_RDONLY);
+    long fp = get_efi_systab_smbios();
+    bool found = false;
+    u8 *mem = NULL;
+    u8 *table = NULL;
+
     if(fd == -1)
         return false;
 
-    if(fp <= 0)
+    if(fp > 0)
+    {
+        if((mem = map_physical(fd, fp, 0x20)) != NULL)
+        {
+            found = smbios_entry_point(mem, 0x20, entry);
+            unmap_physical(mem, 0x20);
+        }
+    }
+    else if((mem = map_physical(fd, BIOS_WINDOW, BIOS_WINDOW_SIZE)) != NULL)
     {
-        efi = false;
-        fp = 0xE0000L; /* default value for non-EFI capable platforms */
+        // non-EFI: the entry point is 16-byte aligned in the BIOS area
+        for(long off = 0; !found && (off + 0x20 <= BIOS_WINDOW_SIZE); off += 16)
+            if(memcmp(mem + off, "_SM3_", 5) == 0)
+                found = smbios_entry_point(mem + off, 0x20, entry);
+        for(long off = 0; !found && (off + 0x20 <= BIOS_WINDOW_SIZE); off += 16)
+            found = smbios_entry_point(mem + off, 0x20, entry);
+        unmap_physical(mem, BIOS_WINDOW_SIZE);
     }
 
-    fp -= 16;
-    while(efi || (fp < 0xFFFE0))
+    if(found && (entry.len > 0) && ((table = map_physical(fd, entry.base, entry.len)) != NULL))
     {
-        fp += 16;
-        mmoffset = fp % getpagesize();
-        mmp = mmap(0, mmoffset + 0x20, PROT_READ, MAP_SHARED, fd, fp - mmoffset);
-        memset(buf, 0, sizeof(buf));
-        if(mmp != MAP_FAILED)
-        {
-            memcpy(buf, (u8 *) mmp + mmoffset, sizeof(buf));
-            munmap(mmp, mmoffset + 0x20);
-        }
-        if(mmp == MAP_FAILED)
-        {
-            close(fd);
-            return false;
-        }
-        else if(memcmp(buf, "_SM_", 4) == 0)
-        {
-            // SMBIOS
-            smmajver = buf[6];
-            smminver = buf[7];
-        }
-        else if(smmajver && (memcmp(buf, "_DMI_", 5) == 0) && checksum(buf, 0x0F))
-        {
-            u16 num = buf[13] << 8 | buf[12];
-            u16 len = buf[7] << 8 | buf[6];
-            u32 base = buf[11] << 24 | buf[10] << 16 | buf[9] << 8 | buf[8];
-            dmimaj = buf[14] ? buf[14] >> 4 : smmajver;
-            dmimin = buf[14] ? buf[14] & 0x0F : smminver;
-            dmi_table(fd, base, len, num, n, dmimaj, dmimin);
-
-            if(efi)
-                break; // we don't need to search the memory for EFI systems
-        }
+        dmi_decode(n, entry, table, entry.len);
+        unmap_physical(table, entry.len);
     }
+
     close(fd);
-    if(smmajver != 0)
+    return found;
+}
+
+bool scan_dmi(hwNode & n)
+{
+    smbios_entry entry;
+    scan_context().currentcpu = 0;
+
+#ifdef __hppa__
+    return false; // SMBIOS not supported on PA-RISC machines
+#endif
+
+    if(sizeof(u8) != 1 || sizeof(u16) != 2 || sizeof(u32) != 4)
+        // compiler incompatibility
+        return false;
+
+    if(!scan_dmi_sysfs(n, entry) && !scan_dmi_devmem(n, entry))
+        return false;
+
+    if(entry.smmajver != 0)
     {
         char buffer[20];
-        snprintf(buffer, sizeof(buffer), "%d.%d", smmajver, smminver);
+        snprintf(buffer, sizeof(buffer), "%d.%d", entry.smmajver, entry.smminver);
         n.addCapability("smbios-" + string(buffer), "SMBIOS version " + string(buffer));
     }
-    if(dmimaj != 0)
+    if(entry.dmimaj != 0)
     {
         char buffer[20];
-        snprintf(buffer, sizeof(buffer), "%d.%d", dmimaj, dmimin);
+        snprintf(buffer, sizeof(buffer), "%d.%d", entry.dmimaj, entry.dmimin);
         n.addCapability("dmi-" + string(buffer), "DMI version " + string(buffer));
     }
 
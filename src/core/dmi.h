@@ -4,4 +4,11 @@
 #include "hw.h"
 
 bool scan_dmi(hwNode & n);
+
+/*
+ * decoded tables are cached in a file, keyed by the entry point checksum
+ * and a hash of the table; an empty path disables the cache
+ */
+void dmi_cache_file(const string & path);
+bool dmi_cache_invalidate();
 #endif
@@ -12,9 +12,16 @@ struct device;
 struct framebuffer;
 struct slide;
 
-static double gear1_rotation = 0.35;
-static double gear2_rotation = 0.33;
-static double gear3_rotation = 0.50;
+struct gears_state {
+    double gear1_rotation;
+    double gear2_rotation;
+    double gear3_rotation;
+};
+
+struct gear_result {
+    double fps;     // frames per second, summed over all surfaces
+    double pixels;  // pixels rendered per second
+};
 
 struct framebuffer {
     struct device *device;
@@ -43,4 +50,5 @@ struct xlib_device
 };
 
 double gear_fps();
+gear_result gear_offscreen(int width, int height, int surfaces, double seconds);
 #endif
\ No newline at end of file
@@ -7,8 +7,10 @@
 #include "sysfs.h"
 #include "jedec.h"
 #include "osutils.h"
+#include "prefixtrie.h"
 
 #include <stdlib.h>
+#include <ctype.h>
 #include <regex.h>
 
 string guessBusInfo(const string & info)
@@ -94,28 +96,35 @@ static const char *disk_manufacturers[] = {
 
 bool guessVendor(hwNode & device)
 {
-    int i = 0;
-    bool result = false;
-
+    static const prefix_trie manufacturers(disk_manufacturers);
+    int i = -1;
 
     device.setVendor(jedec_resolve(device.getVendor()));
 
     if(device.getVendor() != "")
         return false;
 
-
+    // the last matching entry of the table wins
     if(device.getClass() == hw::disk)
-        while(disk_manufacturers[i])
-        {
-            if(matches(device.getProduct().c_str(), disk_manufacturers[i], REG_ICASE))
-            {
-                device.setVendor(disk_manufacturers[i + 1]);
-                result = true;
-            }
-            i += 2;
-        }
+        i = manufacturers.match(device.getProduct(), true);
+    if(i < 0)
+        return false;
 
-    return result;
+    device.setVendor(disk_manufacturers[2 * i + 1]);
+    return true;
+}
+
+// "0x" followed by at least two hex digits
+static bool ishexstring(const string & s)
+{
+    if((s.length() < 4) || (s.compare(0, 2, "0x") != 0))
+        return false;
+
+    for(size_t i = 2; i < s.length(); i++)
+        if(!isxdigit((unsigned char) s[i]))
+            return false;
+
+    return true;
 }
 
 static string parsehex(const string & s)
@@ -123,7 +132,7 @@ static string parsehex(const string & s)
     size_t i = 0;
     string result = "";
 
-    if(matches(s, "^0x[[:xdigit:]][[:xdigit:]]+$"))
+    if(ishexstring(s))
     {
         for(i = 2; i < s.length(); i += 2)
         {
@@ -38,29 +38,21 @@ struct hwNode_i
     map < string, value > hints;
 };
 
+// trims blanks, drops control characters and invalid UTF-8, in one pass
 string hw::strip(const string & s)
 {
-    string result = s;
-    size_t i = result.find('\0');
+    const char *begin = s.data();
+    const char *end = (const char *) memchr(begin, '\0', s.length());
 
-    if(i != string::npos)
-        result = result.substr(0, i);
+    if(!end)
+        end = begin + s.length();
 
-    while((result.length() > 0) && ((uint8_t) result[0] <= ' '))
-        result.erase(0, 1);
-    while((result.length() > 0) && ((uint8_t) result[result.length() - 1] <= ' '))
-        result.erase(result.length() - 1);
+    while((begin < end) && ((uint8_t) *begin <= ' '))
+        begin++;
+    while((end > begin) && ((uint8_t) end[-1] <= ' '))
+        end--;
 
-    for(i = 0; i < result.length(); i++)
-        if((uint8_t) result[i] < ' ')
-        {
-            result.erase(i, 1);
-            i--;
-        }
-
-    result = utf8_sanitize(result);
-
-    return result;
+    return utf8_sanitize(begin, end - begin, false);
 }
 
 string hw::asString(long n)
@@ -1093,6 +1085,27 @@ void hwNode::fixInconsistencies()
         This->children[i].fixInconsistencies();
 }
 
+void hwNode::pruneInvisible()
+{
+    vector < hwNode > kept;
+
+    if(!This)
+        return;
+
+    for(unsigned int i = 0; i < This->children.size(); i++)
+    {
+        hwNode & child = This->children[i];
+
+        child.pruneInvisible();
+        if(visible(child.getClassName()))
+            kept.push_back(child);
+        else
+            kept.insert(kept.end(), child.This->children.begin(), child.This->children.end());
+    }
+
+    This->children.swap(kept);
+}
+
 void hwNode::merge(const hwNode & node)
 {
     if(!This)
@@ -1228,7 +1241,7 @@ string hwNode::asXML(unsigned level)
         if(geteuid() != 0)
             out << "<!-- WARNING: not running as root -->" << endl;
 
-        if(::enabled("output:list"))
+        if(::enabled(OPT_OUTPUT_LIST))
             out << "<list>" << endl;
     }
 
@@ -1336,7 +1349,7 @@ string hwNode::asXML(unsigned level)
         {
             out << spaces(2 * tab + 2);
             out << "<serial>";
-            out << (::enabled("output:sanitize") ? REMOVED : escape(getSerial()));
+            out << (::enabled(OPT_OUTPUT_SANITIZE) ? REMOVED : escape(getSerial()));
             out << "</serial>";
             out << endl;
         }
@@ -1451,7 +1464,9 @@ string hwNode::asXML(unsigned level)
             for(unsigned int j = 0; j < config.size(); j++)
             {
                 out << spaces(2 * tab + 4);
-                out << "<setting id=\"" << escape(config[j]) << "\" value=\"" << escape(getConfig(config[j])) << "\" />";
+                out << "<setting id=\"" << escape(config[j]) << "\" value=\"";
+                out << ((::enabled(OPT_OUTPUT_SANITIZE) && (config[j] == "uuid")) ? REMOVED : escape(getConfig(config[j])));
+                out << "\" />";
                 out << endl;
             }
             out << spaces(2 * tab + 2);
@@ -1500,12 +1515,200 @@ string hwNode::asXML(unsigned level)
 
 
 
-    if((level == 0) && ::enabled("output:list"))
+    if((level == 0) && ::enabled(OPT_OUTPUT_LIST))
         out << "</list>" << endl;
 
     return out.str();
 }
 
+// backslash-escapes the characters used as separators by serialize()
+static string escape_field(const string & s)
+{
+    string result = "";
+
+    for(unsigned int i = 0; i < s.length(); i++)
+        switch(s[i])
+        {
+            case '\\':
+                result += "\\\\";
+                break;
+            case '\n':
+                result += "\\n";
+                break;
+            case '\t':
+                result += "\\t";
+                break;
+            default:
+                result += s[i];
+        }
+
+    return result;
+}
+
+static string unescape_field(const string & s)
+{
+    string result = "";
+
+    for(unsigned int i = 0; i < s.length(); i++)
+        if((s[i] == '\\') && (i + 1 < s.length()))
+        {
+            i++;
+            result += (s[i] == 'n') ? '\n' : (s[i] == 't') ? '\t' : s[i];
+        }
+        else
+            result += s[i];
+
+    return result;
+}
+
+/*
+ * one "field<TAB>value" line per attribute, children nested between
+ * "node" and "end" lines; hints are kept as text
+ */
+string hwNode::serialize() const
+{
+    ostringstream out;
+
+    if(!This)
+        return "";
+
+    out << "node\t" << escape_field(This->id) << endl;
+    out << "class\t" << (int) This->deviceclass << endl;
+    out << "vendor\t" << escape_field(This->vendor) << endl;
+    out << "product\t" << escape_field(This->product) << endl;
+    out << "version\t" << escape_field(This->version) << endl;
+    out << "date\t" << escape_field(This->date) << endl;
+    out << "serial\t" << escape_field(This->serial) << endl;
+    out << "slot\t" << escape_field(This->slot) << endl;
+    out << "handle\t" << escape_field(This->handle) << endl;
+    out << "description\t" << escape_field(This->description) << endl;
+    out << "businfo\t" << escape_field(This->businfo) << endl;
+    out << "physid\t" << escape_field(This->physid) << endl;
+    out << "dev\t" << escape_field(This->dev) << endl;
+    out << "enabled\t" << This->enabled << endl;
+    out << "claimed\t" << This->claimed << endl;
+    out << "start\t" << This->start << endl;
+    out << "size\t" << This->size << endl;
+    out << "capacity\t" << This->capacity << endl;
+    out << "clock\t" << This->clock << endl;
+    out << "width\t" << This->width << endl;
+    for(unsigned int i = 0; i < This->attracted.size(); i++)
+        out << "attract\t" << escape_field(This->attracted[i]) << endl;
+    for(unsigned int i = 0; i < This->features.size(); i++)
+        out << "capability\t" << escape_field(This->features[i]) << endl;
+    for(map < string, string >::const_iterator i = This->features_descriptions.begin();
+            i != This->features_descriptions.end(); i++)
+        out << "describe\t" << escape_field(i->first) << "\t" << escape_field(i->second) << endl;
+    for(unsigned int i = 0; i < This->logicalnames.size(); i++)
+        out << "logicalname\t" << escape_field(This->logicalnames[i]) << endl;
+    for(map < string, string >::const_iterator i = This->config.begin();
+            i != This->config.end(); i++)
+        out << "config\t" << escape_field(i->first) << "\t" << escape_field(i->second) << endl;
+    for(map < string, value >::const_iterator i = This->hints.begin();
+            i != This->hints.end(); i++)
+        out << "hint\t" << escape_field(i->first) << "\t" << escape_field(i->second.asString()) << endl;
+    for(unsigned int i = 0; i < This->children.size(); i++)
+        out << This->children[i].serialize();
+    out << "end" << endl;
+
+    return out.str();
+}
+
+bool hwNode::unserialize(const vector < string > &lines, unsigned int &line)
+{
+    if(!This || (line >= lines.size()) || (lines[line].compare(0, 5, "node\t") != 0))
+        return false;
+
+    *This = hwNode_i();
+    This->id = unescape_field(lines[line].substr(5));
+
+    for(line++; line < lines.size(); line++)
+    {
+        const string & l = lines[line];
+        size_t tab = l.find('\t');
+        string field = l.substr(0, tab);
+        string data = (tab == string::npos) ? "" : l.substr(tab + 1);
+        size_t tab2 = data.find('\t');
+        string key = unescape_field(data.substr(0, tab2));
+        string arg = (tab2 == string::npos) ? "" : unescape_field(data.substr(tab2 + 1));
+
+        if(field == "end")
+            return true;
+        else if(field == "node")
+        {
+            hwNode child("");
+
+            if(!child.unserialize(lines, line))
+                return false;
+            This->children.push_back(child);
+        }
+        else if(field == "class")
+            This->deviceclass = (hwClass) atoi(data.c_str());
+        else if(field == "vendor")
+            This->vendor = key;
+        else if(field == "product")
+            This->product = key;
+        else if(field == "version")
+            This->version = key;
+        else if(field == "date")
+            This->date = key;
+        else if(field == "serial")
+            This->serial = key;
+        else if(field == "slot")
+            This->slot = key;
+        else if(field == "handle")
+            This->handle = key;
+        else if(field == "description")
+            This->description = key;
+        else if(field == "businfo")
+            This->businfo = key;
+        else if(field == "physid")
+            This->physid = key;
+        else if(field == "dev")
+            This->dev = key;
+        else if(field == "enabled")
+            This->enabled = (data == "1");
+        else if(field == "claimed")
+            This->claimed = (data == "1");
+        else if(field == "start")
+            This->start = strtoull(data.c_str(), NULL, 10);
+        else if(field == "size")
+            This->size = strtoull(data.c_str(), NULL, 10);
+        else if(field == "capacity")
+            This->capacity = strtoull(data.c_str(), NULL, 10);
+        else if(field == "clock")
+            This->clock = strtoull(data.c_str(), NULL, 10);
+        else if(field == "width")
+            This->width = atoi(data.c_str());
+        else if(field == "attract")
+            This->attracted.push_back(key);
+        else if(field == "capability")
+            This->features.push_back(key);
+        else if(field == "describe")
+            This->features_descriptions[key] = arg;
+        else if(field == "logicalname")
+            This->logicalnames.push_back(key);
+        else if(field == "config")
+            This->config[key] = arg;
+        else if(field == "hint")
+            This->hints[key] = value(arg);
+        else
+            return false;
+    }
+
+    return false;                                 // truncated
+}
+
+bool hwNode::unserialize(const string & data)
+{
+    vector < string > lines;
+    unsigned int line = 0;
+
+    splitlines(data, lines, '\n');
+
+    return unserialize(lines, line);
+}
+
 struct hw::value_i
 {
     hw::hwValueType type;
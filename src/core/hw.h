@@ -184,14 +184,20 @@ class hwNode
     void merge(const hwNode & node);
 
     void fixInconsistencies();
+    // drops the invisible children, their visible descendants take their place
+    void pruneInvisible();
 
     string asXML(unsigned level = 0);
 
+    string serialize() const;
+    bool unserialize(const string & data);
+
   private:
     void setId(const string & id);
 
     bool attractsHandle(const string & handle) const;
     bool attractsNode(const hwNode & node) const;
+    bool unserialize(const vector < string > &lines, unsigned int &line);
 
     struct hwNode_i * This;
 };
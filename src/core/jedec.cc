@@ -1,7 +1,8 @@
 #include "jedec.h"
 #include "hw.h"
 #include "osutils.h"
-#include <regex.h>
+#include "prefixtrie.h"
+#include <ctype.h>
 #include <string>
 #include <iostream>
 
@@ -76,16 +77,19 @@ static const char * jedec_id[] = {
 
 string jedec_resolve(const string & s)
 {
+    static const prefix_trie ids(jedec_id, true);
     string result = hw::strip(s);
+    int i = -1;
 
-    if(matches(result, "^0x"))
+    if(result.compare(0, 2, "0x") == 0)
         result.erase(0, 2);
-    if(!matches(result, "^[0-9a-fA-F]+$")) return s;
+    if(result == "")
+        return s;
+    for(size_t j = 0; j < result.length(); j++)
+        if(!isxdigit((unsigned char) result[j]))
+            return s;
 
-    for(int i = 0; jedec_id[i]; i += 2)
-    {
-        if(matches(result, "^" + string(jedec_id[i]), REG_ICASE)) return string(jedec_id[i + 1]);
-    }
-
-    return s;
+    // the first matching entry of the table wins
+    i = ids.match(result);
+    return (i < 0) ? s : string(jedec_id[2 * i + 1]);
 }
@@ -5,48 +5,1013 @@
  * Created on 2011年10月13日, 下午1:25
  */
 #include <boost/python.hpp>
+#include <boost/bind.hpp>
+#include <errno.h>
+#include <sys/time.h>
 #include "main.h"
 #include "options.h"
+#include "dmi.h"
 #include "super.h"
+#include "cpubench.h"
 #include "stream.h"
 #include "gears.h"
+#include "diskbench.h"
+#include "stripbench.h"
 #include "sensors.h"
+#include "telemetry.h"
+#include "sysfs.h"
+#include "modalias.h"
 #include "lshw.h"
 
 using namespace boost::python;
 
-lshw::lshw()
+lshw::lshw() : scans(0)
 {
+    pthread_mutex_init(&busy, NULL);
     computer = new hwNode("computer", hw::system);
+    context.settings.enable(OPT_OUTPUT_NUMERIC);
+    context.settings.disable(OPT_OUTPUT_SANITIZE);
 }
 
 lshw::~lshw()
 {
     if(computer)
         delete computer;
+    pthread_mutex_destroy(&busy);
+}
+
+// one scan, handed to the thread started by run_isolated()
+struct scan_call
+{
+    lshw *owner;
+    bool filtered;
+    vector < string > classes;
+    vector < string > subsystems;
+    bool result;
+};
+
+void lshw::scan_thread(void *arg)
+{
+    scan_call *call = (scan_call *) arg;
+    lshw *l = call->owner;
+
+    pthread_mutex_lock(&l->busy);
+    // a filtered scan runs on a copy, the instance's settings stay as they are
+    options settings = l->context.settings;
+    if(call->filtered)
+        restrict_scan(settings, call->classes, call->subsystems);
+    {
+        scoped_context scope(l->context, &settings);
+
+        call->result = scan_system(*l->computer);
+    }
+    l->scans++;
+    pthread_mutex_unlock(&l->busy);
+}
+
+bool lshw::scan()
+{
+    scan_call call;
+
+    call.owner = this;
+    call.filtered = false;
+    call.result = false;
+    run_isolated(scan_thread, &call);
+
+    return call.result;
+}
+
+bool lshw::scan_filtered(const vector < string > & classes, const vector < string > & subsystems)
+{
+    scan_call call;
+
+    call.owner = this;
+    call.filtered = true;
+    call.classes = classes;
+    call.subsystems = subsystems;
+    call.result = false;
+    run_isolated(scan_thread, &call);
+
+    return call.result;
 }
 
 void lshw::scan_device()
 {
-    enable("output:numeric");
-    disable("output:sanitize");
-    scan_system(*computer);
+    without_gil nogil;
+
+    scan();
 }
 
 string lshw::get_xml()
 {
-    return computer->asXML();
+    without_gil nogil;
+    scoped_context scope(context);
+    string result;
+
+    pthread_mutex_lock(&busy);
+    result = computer->asXML();
+    pthread_mutex_unlock(&busy);
+
+    return result;
+}
+
+// the settings are read by the scans: changed between them, never during one
+void lshw::enable(const string & option)
+{
+    without_gil nogil;
+
+    pthread_mutex_lock(&busy);
+    context.settings.enable(option.c_str());
+    pthread_mutex_unlock(&busy);
+}
+
+void lshw::disable(const string & option)
+{
+    without_gil nogil;
+
+    pthread_mutex_lock(&busy);
+    context.settings.disable(option.c_str());
+    pthread_mutex_unlock(&busy);
+}
+
+bool lshw::enabled(const string & option)
+{
+    without_gil nogil;
+    bool result = false;
+
+    pthread_mutex_lock(&busy);
+    result = context.settings.enabled(option.c_str());
+    pthread_mutex_unlock(&busy);
+
+    return result;
+}
+
+void lshw::set_sysfs_root(const string & path)
+{
+    without_gil nogil;
+
+    pthread_mutex_lock(&busy);
+    context.sysfs_root = path;
+    pthread_mutex_unlock(&busy);
+}
+
+string lshw::sysfs_root()
+{
+    return context.sysfs_root;
+}
+
+static void find_disks(hwNode & node, vector < string > & result)
+{
+    if(node.getClass() == hw::disk && node.getLogicalName().compare(0, 5, "/dev/") == 0)
+        result.push_back(node.getLogicalName());
+
+    for(unsigned int i = 0; i < node.countChildren(); i++)
+        find_disks(*node.getChild(i), result);
+}
+
+boost::python::list lshw::get_disks()
+{
+    boost::python::list result;
+    vector < string > disks;
+
+    {
+        without_gil nogil;
+
+        pthread_mutex_lock(&busy);
+        find_disks(*computer, disks);
+        pthread_mutex_unlock(&busy);
+    }
+    for(unsigned int i = 0; i < disks.size(); i++)
+        result.append(disks[i]);
+    return result;
+}
+
+hwNode *lshw::acquire(unsigned long g)
+{
+    {
+        without_gil nogil;
+
+        pthread_mutex_lock(&busy);
+    }
+    if(g != scans)
+    {
+        pthread_mutex_unlock(&busy);
+        return NULL;
+    }
+
+    return computer;
+}
+
+void lshw::release()
+{
+    pthread_mutex_unlock(&busy);
+}
+
+// locks the tree of a node proxy and resolves its path while in scope
+class tree_access
+{
+public:
+    tree_access(const node & n) : owner(extract < lshw & >(n.owner)), current(NULL)
+    {
+        current = owner.acquire(n.generation);
+        if(!current)
+            stale();
+
+        for(unsigned int i = 0; i < n.path.size(); i++)
+        {
+            current = current->getChild(n.path[i]);
+            if(!current)
+            {
+                owner.release();
+                stale();
+            }
+        }
+    }
+
+    ~tree_access()
+    {
+        owner.release();
+    }
+
+    hwNode * operator ->() const { return current; }
+    hwNode & operator *() const { return *current; }
+
+private:
+    static void stale()
+    {
+        PyErr_SetString(PyExc_RuntimeError, "the hardware tree has been scanned again");
+        throw_error_already_set();
+    }
+
+    lshw & owner;
+    hwNode *current;
+};
+
+node::node(object o, const vector < unsigned int > & p, unsigned long g) : owner(o), path(p), generation(g)
+{
+}
+
+string node::id() const { tree_access n(*this); return n->getId(); }
+string node::hwclass() const { tree_access n(*this); return n->getClassName(); }
+string node::description() const { tree_access n(*this); return n->getDescription(); }
+string node::vendor() const { tree_access n(*this); return n->getVendor(); }
+string node::product() const { tree_access n(*this); return n->getProduct(); }
+string node::version() const { tree_access n(*this); return n->getVersion(); }
+string node::serial() const { tree_access n(*this); return n->getSerial(); }
+string node::date() const { tree_access n(*this); return n->getDate(); }
+string node::slot() const { tree_access n(*this); return n->getSlot(); }
+string node::businfo() const { tree_access n(*this); return n->getBusInfo(); }
+string node::handle() const { tree_access n(*this); return n->getHandle(); }
+string node::physid() const { tree_access n(*this); return n->getPhysId(); }
+string node::logicalname() const { tree_access n(*this); return n->getLogicalName(); }
+unsigned long long node::size() const { tree_access n(*this); return n->getSize(); }
+unsigned long long node::capacity() const { tree_access n(*this); return n->getCapacity(); }
+unsigned long long node::clock() const { tree_access n(*this); return n->getClock(); }
+unsigned int node::width() const { tree_access n(*this); return n->getWidth(); }
+bool node::claimed() const { tree_access n(*this); return n->claimed(); }
+bool node::enabled() const { tree_access n(*this); return n->enabled(); }
+bool node::capable(const string & feature) const { tree_access n(*this); return n->isCapable(feature); }
+unsigned int node::count() const { tree_access n(*this); return n->countChildren(); }
+
+boost::python::list node::logicalnames() const
+{
+    boost::python::list result;
+    vector < string > names;
+
+    {
+        tree_access n(*this);
+
+        names = n->getLogicalNames();
+    }
+    for(unsigned int i = 0; i < names.size(); i++)
+        result.append(names[i]);
+    return result;
+}
+
+dict node::config() const
+{
+    dict result;
+    vector < string > keys;
+    vector < string > values;
+
+    {
+        tree_access n(*this);
+
+        keys = n->getConfigKeys();
+        for(unsigned int i = 0; i < keys.size(); i++)
+            values.push_back(n->getConfig(keys[i]));
+    }
+    for(unsigned int i = 0; i < keys.size(); i++)
+        result[keys[i]] = values[i];
+    return result;
+}
+
+dict node::capabilities() const
+{
+    dict result;
+    vector < string > features;
+    vector < string > descriptions;
+
+    {
+        tree_access n(*this);
+
+        features = n->getCapabilitiesList();
+        for(unsigned int i = 0; i < features.size(); i++)
+            descriptions.push_back(n->getCapabilityDescription(features[i]));
+    }
+    for(unsigned int i = 0; i < features.size(); i++)
+        result[features[i]] = descriptions[i];
+    return result;
+}
+
+object node::parent() const
+{
+    vector < unsigned int > up = path;
+    tree_access n(*this);                         // raises if the tree was scanned again
+
+    if(up.size() == 0)
+        return object();
+    up.pop_back();
+    return object(node(owner, up, generation));
+}
+
+boost::python::list node::children() const
+{
+    boost::python::list result;
+    vector < unsigned int > child = path;
+    unsigned int count = this->count();
+
+    child.push_back(0);
+    for(unsigned int i = 0; i < count; i++)
+    {
+        child.back() = i;
+        result.append(node(owner, child, generation));
+    }
+    return result;
+}
+
+// paths of the nodes below (and including) n, in document order
+static void select_paths(hwNode & n, const string & hwclass, vector < unsigned int > & path,
+        vector < vector < unsigned int > > & result)
+{
+    if((hwclass == "") || (hwclass == n.getClassName()))
+        result.push_back(path);
+
+    path.push_back(0);
+    for(unsigned int i = 0; i < n.countChildren(); i++)
+    {
+        path.back() = i;
+        select_paths(*n.getChild(i), hwclass, path, result);
+    }
+    path.pop_back();
+}
+
+boost::python::list node::nodes(const string & hwclass) const
+{
+    boost::python::list result;
+    vector < vector < unsigned int > > paths;
+
+    {
+        tree_access n(*this);
+        vector < unsigned int > start = path;
+
+        select_paths(*n, hwclass, start, paths);
+    }
+    for(unsigned int i = 0; i < paths.size(); i++)
+        result.append(node(owner, paths[i], generation));
+    return result;
+}
+
+boost::python::list node::select(object owner, const string & hwclass)
+{
+    lshw & l = extract < lshw & >(owner);
+
+    return node(owner, vector < unsigned int >(), l.generation()).nodes(hwclass);
+}
+
+static bool find_path(hwNode & n, const string & what, const string & value, vector < unsigned int > & path)
+{
+    if(((what == "handle") && (n.getHandle() == value)) ||
+            ((what == "businfo") && (n.getBusInfo() == value)) ||
+            ((what == "logicalname") && (n.getLogicalName() == value)))
+        return true;
+
+    path.push_back(0);
+    for(unsigned int i = 0; i < n.countChildren(); i++)
+    {
+        path.back() = i;
+        if(find_path(*n.getChild(i), what, value, path))
+            return true;
+    }
+    path.pop_back();
+
+    return false;
+}
+
+// what is "handle", "businfo" or "logicalname"; None when nothing matches
+object node::find(object owner, const string & what, const string & value)
+{
+    lshw & l = extract < lshw & >(owner);
+    node root(owner, vector < unsigned int >(), l.generation());
+    vector < unsigned int > found;
+    bool result = false;
+
+    if(value == "")
+        return object();
+    {
+        tree_access n(root);
+
+        result = find_path(*n, what, value, found);
+    }
+
+    return result ? object(node(owner, found, root.generation)) : object();
+}
+
+static object lshw_root(object self)
+{
+    lshw & l = extract < lshw & >(self);
+
+    return object(node(self, vector < unsigned int >(), l.generation()));
+}
+
+static object find_handle(object self, const string & value)
+{
+    return node::find(self, "handle", value);
+}
+
+static object find_businfo(object self, const string & value)
+{
+    return node::find(self, "businfo", value);
+}
+
+static object find_logicalname(object self, const string & value)
+{
+    return node::find(self, "logicalname", value);
+}
+
+static object node_iter(const node & n)
+{
+    return object(handle<>(PyObject_GetIter(n.children().ptr())));
+}
+
+static string node_repr(const node & n)
+{
+    return "<lshw.node " + n.id() + " (" + n.hwclass() + ")>";
+}
+
+task::task() : started(false), finished(false)
+{
+    pthread_mutex_init(&lock, NULL);
+    pthread_cond_init(&finished_cond, NULL);
+}
+
+task::~task()
+{
+    join();
+    pthread_cond_destroy(&finished_cond);
+    pthread_mutex_destroy(&lock);
+}
+
+void *task::thread_main(void *arg)
+{
+    task *t = (task *) arg;
+    string error = "";
+
+    try
+    {
+        t->run();
+    }
+    catch(std::exception & e)
+    {
+        error = e.what();
+    }
+    catch(...)
+    {
+        error = "native call failed";
+    }
+
+    pthread_mutex_lock(&t->lock);
+    t->error = error;
+    t->finished = true;
+    pthread_cond_broadcast(&t->finished_cond);
+    pthread_mutex_unlock(&t->lock);
+
+    return NULL;
+}
+
+// called by the derived constructor, once the call is fully set up
+void task::start()
+{
+    started = (pthread_create(&thread, NULL, thread_main, this) == 0);
+    if(!started)
+    {
+        error = "cannot start thread";
+        finished = true;
+    }
+}
+
+// must run before the derived members are destroyed
+void task::join()
+{
+    if(!started)
+        return;
+    if(!done())
+    {
+        without_gil nogil;
+
+        pthread_join(thread, NULL);
+    }
+    else
+        pthread_join(thread, NULL);
+    started = false;
+}
+
+bool task::done()
+{
+    bool result = false;
+
+    pthread_mutex_lock(&lock);
+    result = finished;
+    pthread_mutex_unlock(&lock);
+
+    return result;
+}
+
+// timeout in seconds, negative waits forever; true once the call is done
+bool task::wait(double timeout)
+{
+    without_gil nogil;
+    struct timeval now;
+    struct timespec deadline;
+    int err = 0;
+
+    gettimeofday(&now, NULL);
+    deadline.tv_sec = now.tv_sec + (time_t) timeout;
+    deadline.tv_nsec = now.tv_usec * 1000 + (long) ((timeout - (time_t) timeout) * 1e9);
+    if(deadline.tv_nsec >= 1000000000)
+    {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000;
+    }
+
+    pthread_mutex_lock(&lock);
+    while(!finished && (err != ETIMEDOUT))
+        err = (timeout < 0) ? pthread_cond_wait(&finished_cond, &lock) :
+            pthread_cond_timedwait(&finished_cond, &lock, &deadline);
+    err = finished;
+    pthread_mutex_unlock(&lock);
+
+    return err;
+}
+
+boost::python::object task::result()
+{
+    wait();
+    if(error != "")
+    {
+        PyErr_SetString(PyExc_RuntimeError, error.c_str());
+        throw_error_already_set();
+    }
+
+    return value();
+}
+
+/*
+ * the long-running bindings: native code runs without the GIL so that
+ * other Python threads (the GTK UI) keep going, and each has an *_async
+ * variant returning a task
+ */
+static task *scan_device_async(object self)
+{
+    lshw & l = extract < lshw & >(self);
+
+    return new call_task < bool >(boost::bind(&lshw::scan, &l), self);
+}
+
+static vector < string > strings(object sequence)
+{
+    vector < string > result;
+
+    for(long i = 0; i < len(sequence); i++)
+        result.push_back(extract < string >(sequence[i]));
+
+    return result;
+}
+
+// checks the class and subsystem names while the GIL is still held
+static void check_filter(const vector < string > & classes, const vector < string > & subsystems)
+{
+    options settings;
+
+    if(!restrict_scan(settings, classes, subsystems))
+    {
+        PyErr_SetString(PyExc_ValueError, "unknown class or subsystem");
+        throw_error_already_set();
+    }
+}
+
+static bool scan_partial(lshw & l, object classes, object subsystems)
+{
+    vector < string > c = strings(classes), s = strings(subsystems);
+
+    check_filter(c, s);
+
+    without_gil nogil;
+    return l.scan_filtered(c, s);
+}
+
+static task *scan_partial_async(object self, object classes, object subsystems)
+{
+    lshw & l = extract < lshw & >(self);
+    vector < string > c = strings(classes), s = strings(subsystems);
+
+    check_filter(c, s);
+    return new call_task < bool >(boost::bind(&lshw::scan_filtered, &l, c, s), self);
+}
+
+static string sensors_nogil()
+{
+    without_gil nogil;
+
+    return sensors();
+}
+
+static double stream_triad_nogil()
+{
+    without_gil nogil;
+
+    return stream_triad();
+}
+
+static task *stream_triad_async()
+{
+    return new call_task < double >(stream_triad);
+}
+
+static double super_pi_nogil()
+{
+    without_gil nogil;
+
+    return super_pi();
+}
+
+static task *super_pi_async()
+{
+    return new call_task < double >(super_pi);
+}
+
+static double gear_fps_nogil()
+{
+    without_gil nogil;
+
+    return gear_fps();
+}
+
+static task *gear_fps_async()
+{
+    return new call_task < double >(gear_fps);
+}
+
+static gear_result gear_offscreen_nogil(int width, int height, int surfaces, double seconds)
+{
+    without_gil nogil;
+
+    return gear_offscreen(width, height, surfaces, seconds);
+}
+
+static task *gear_offscreen_async(int width, int height, int surfaces, double seconds)
+{
+    return new call_task < gear_result >(boost::bind(gear_offscreen, width, height, surfaces, seconds));
+}
+
+static disk_result disk_bench_nogil(const string & path, const string & test,
+        int depth, int blocksize, long long size, double seconds)
+{
+    without_gil nogil;
+
+    return disk_bench(path, test, depth, blocksize, size, seconds);
+}
+
+static task *disk_bench_async(const string & path, const string & test,
+        int depth, int blocksize, long long size, double seconds)
+{
+    return new call_task < disk_result >(boost::bind(disk_bench, path, test, depth, blocksize, size, seconds));
+}
+
+static double strip_bench_nogil(const string & corpus, double seconds)
+{
+    without_gil nogil;
+
+    return strip_bench(corpus, seconds);
+}
+
+static task *strip_bench_async(const string & corpus, double seconds)
+{
+    return new call_task < double >(boost::bind(strip_bench, corpus, seconds));
+}
+
+// cpu_hash, cpu_parse... share the same signature
+template < double (*kernel)(int) > static double cpu_nogil(int threads)
+{
+    without_gil nogil;
+
+    return kernel(threads);
+}
+
+template < double (*kernel)(int) > static task *cpu_async(int threads)
+{
+    return new call_task < double >(boost::bind(kernel, threads));
+}
+
+static boost::python::list sensors_channels_list()
+{
+    boost::python::list result;
+    vector<string> channels = sensors_channels();
+
+    for(unsigned int i = 0; i < channels.size(); i++)
+        result.append(channels[i]);
+    return result;
+}
+
+static boost::python::list modaliases()
+{
+    boost::python::list result;
+    vector < string > found;
+
+    {
+        without_gil nogil;
+        found = sysfs_modaliases();
+    }
+    for(unsigned int i = 0; i < found.size(); i++)
+        result.append(found[i]);
+    return result;
+}
+
+static boost::python::list as_list(const vector < pair < string, string > > & v)
+{
+    boost::python::list result;
+
+    for(unsigned int i = 0; i < v.size(); i++)
+        result.append(boost::python::make_tuple(v[i].first, v[i].second));
+    return result;
+}
+
+static unsigned int alias_load(alias_matcher & m, const string & path, const string & package)
+{
+    without_gil nogil;
+
+    return m.load(path, package);
+}
+
+static boost::python::list alias_match(const alias_matcher & m, const string & modalias)
+{
+    return as_list(m.match(modalias));
+}
+
+/*
+ * {modalias: [(module, package), ...]} for the given modaliases, or for
+ * those of the devices of this machine
+ */
+static dict alias_match_devices(const alias_matcher & m, object modaliases)
+{
+    map < string, vector < pair < string, string > > > found;
+    vector < string > devices;
+    dict result;
+
+    if(!modaliases.is_none())
+        devices = strings(modaliases);
+
+    {
+        without_gil nogil;
+
+        if(modaliases.is_none())
+            devices = sysfs_modaliases();
+        found = m.match(devices);
+    }
+
+    for(map < string, vector < pair < string, string > > >::const_iterator i = found.begin(); i != found.end(); i++)
+        result[i->first] = as_list(i->second);
+    return result;
+}
+
+static boost::python::list as_list(const vector < pair < string, driver_package > > & v)
+{
+    boost::python::list result;
+
+    for(unsigned int i = 0; i < v.size(); i++)
+        result.append(boost::python::make_tuple(v[i].first,
+                boost::python::make_tuple(v[i].second.name, v[i].second.version, v[i].second.description)));
+    return result;
+}
+
+static long build_alias_index_nogil(const string & xml, const string & index)
+{
+    without_gil nogil;
+
+    return build_alias_index(xml, index);
+}
+
+static task *build_alias_index_async(const string & xml, const string & index)
+{
+    return new call_task < long >(boost::bind(build_alias_index, xml, index));
+}
+
+static boost::python::list index_match(const alias_index & a, const string & modalias)
+{
+    return as_list(a.match(modalias));
+}
+
+// {modalias: [(module, (package, version, description)), ...]}, as alias_match_devices()
+static dict index_match_devices(const alias_index & a, object modaliases)
+{
+    map < string, vector < pair < string, driver_package > > > found;
+    vector < string > devices;
+    dict result;
+
+    if(!modaliases.is_none())
+        devices = strings(modaliases);
+
+    {
+        without_gil nogil;
+
+        if(modaliases.is_none())
+            devices = sysfs_modaliases();
+        found = a.match(devices);
+    }
+
+    for(map < string, vector < pair < string, driver_package > > >::const_iterator i = found.begin(); i != found.end(); i++)
+        result[i->first] = as_list(i->second);
+    return result;
+}
+
+static boost::python::list as_list(const vector<double> & v)
+{
+    boost::python::list result;
+
+    for(unsigned int i = 0; i < v.size(); i++)
+        result.append(v[i]);
+    return result;
+}
+
+static dict telemetry_dict(const telemetry & t)
+{
+    dict result;
+    boost::python::list freq;
+
+    for(unsigned int i = 0; i < t.freq.size(); i++)
+        freq.append(as_list(t.freq[i]));
+
+    result["time"] = as_list(t.time);
+    result["freq"] = freq;
+    result["temperature"] = as_list(t.temperature);
+    result["energy"] = as_list(t.energy);
+    return result;
+}
+
+// run a benchmark callable, returns (result, telemetry)
+static boost::python::tuple traced(object test, double rate)
+{
+    object result;
+
+    telemetry_start(rate);
+    try
+    {
+        result = test();
+    }
+    catch(error_already_set &)
+    {
+        telemetry_stop();
+        throw;
+    }
+
+    return boost::python::make_tuple(result, telemetry_dict(telemetry_stop()));
 }
 
 BOOST_PYTHON_MODULE(lshw)
 {
+    class_<task, boost::noncopyable> ("task", "Native call running in the background", no_init)
+            .def("done", &task::done)
+            .def("wait", &task::wait, (boost::python::arg("timeout") = -1.0))
+            .def("result", &task::result)
+            ;
     class_<lshw, boost::noncopyable > ("lshw", "This is a lshw project python extend", init<>())
             .def("scan_device", &lshw::scan_device)
+            .def("scan_device_async", &scan_device_async, return_value_policy<manage_new_object>())
+            .def("scan_partial", &scan_partial,
+                 (boost::python::arg("classes") = boost::python::list(), boost::python::arg("subsystems") = boost::python::list()))
+            .def("scan_partial_async", &scan_partial_async,
+                 (boost::python::arg("classes") = boost::python::list(), boost::python::arg("subsystems") = boost::python::list()),
+                 return_value_policy<manage_new_object>())
             .def("get_xml", &lshw::get_xml)
+            .def("get_disks", &lshw::get_disks)
+            .def("enable", &lshw::enable)
+            .def("disable", &lshw::disable)
+            .def("enabled", &lshw::enabled)
+            .def("set_sysfs_root", &lshw::set_sysfs_root)
+            .def("sysfs_root", &lshw::sysfs_root)
+            .def("root", &lshw_root)
+            .def("nodes", &node::select, (boost::python::arg("hwclass") = ""))
+            .def("find_handle", &find_handle)
+            .def("find_businfo", &find_businfo)
+            .def("find_logicalname", &find_logicalname)
+            ;
+    class_<alias_matcher> ("alias_matcher", "Module aliases matched against device modaliases", init<>())
+            .def("add", &alias_matcher::add,
+                 (boost::python::arg("pattern"), boost::python::arg("module"), boost::python::arg("package") = ""))
+            .def("load", &alias_load, (boost::python::arg("path"), boost::python::arg("package") = ""))
+            .def("match", &alias_match)
+            .def("match_devices", &alias_match_devices, (boost::python::arg("modaliases") = object()))
+            .def("__len__", &alias_matcher::size)
+            ;
+    class_<alias_index, boost::noncopyable> ("alias_index", "Driver catalogue index built by build_alias_index()", init<>())
+            .def("open", &alias_index::open)
+            .def("close", &alias_index::close)
+            .def("match", &index_match)
+            .def("match_devices", &index_match_devices, (boost::python::arg("modaliases") = object()))
+            .def("__len__", &alias_index::size)
+            ;
+    class_<node> ("node", "View of one node of the hardware tree", no_init)
+            .add_property("id", &node::id)
+            .add_property("hwclass", &node::hwclass)
+            .add_property("description", &node::description)
+            .add_property("vendor", &node::vendor)
+            .add_property("product", &node::product)
+            .add_property("version", &node::version)
+            .add_property("serial", &node::serial)
+            .add_property("date", &node::date)
+            .add_property("slot", &node::slot)
+            .add_property("businfo", &node::businfo)
+            .add_property("handle", &node::handle)
+            .add_property("physid", &node::physid)
+            .add_property("logicalname", &node::logicalname)
+            .add_property("logicalnames", &node::logicalnames)
+            .add_property("size", &node::size)
+            .add_property("capacity", &node::capacity)
+            .add_property("clock", &node::clock)
+            .add_property("width", &node::width)
+            .add_property("claimed", &node::claimed)
+            .add_property("enabled", &node::enabled)
+            .add_property("config", &node::config)
+            .add_property("capabilities", &node::capabilities)
+            .add_property("parent", &node::parent)
+            .add_property("children", &node::children)
+            .def("capable", &node::capable)
+            .def("nodes", &node::nodes, (boost::python::arg("hwclass") = ""))
+            .def("__len__", &node::count)
+            .def("__iter__", &node_iter)
+            .def("__repr__", &node_repr)
             ;
-    def("sensors", &sensors);
-    def("gear_fps", &gear_fps);
-    def("super_pi", &super_pi);
+    class_<sensor_stats> ("sensor_stats", "Sensor channel statistics over a time window")
+            .def_readonly("min", &sensor_stats::min)
+            .def_readonly("max", &sensor_stats::max)
+            .def_readonly("avg", &sensor_stats::avg)
+            .def_readonly("samples", &sensor_stats::samples)
+            ;
+    def("modaliases", &modaliases);
+    def("build_alias_index", &build_alias_index_nogil);
+    def("build_alias_index_async", &build_alias_index_async, return_value_policy<manage_new_object>());
+    def("sensors", &sensors_nogil);
+    def("sensors_start", &sensors_start);
+    def("sensors_stop", &sensors_stop);
+    def("sensors_channels", &sensors_channels_list);
+    def("sensors_read", &sensors_read);
+    def("sensors_window", &sensors_window);
+    class_<gear_result> ("gear_result", "Offscreen rendering benchmark result")
+            .def_readonly("fps", &gear_result::fps)
+            .def_readonly("pixels", &gear_result::pixels)
+            ;
+    class_<disk_result> ("disk_result", "Disk benchmark result")
+            .def_readonly("bandwidth", &disk_result::bandwidth)
+            .def_readonly("iops", &disk_result::iops)
+            .def_readonly("lat_p50", &disk_result::lat_p50)
+            .def_readonly("lat_p95", &disk_result::lat_p95)
+            .def_readonly("lat_p99", &disk_result::lat_p99)
+            .def_readonly("engine", &disk_result::engine)
+            .def_readonly("direct", &disk_result::direct)
+            ;
+    def("disk_bench", &disk_bench_nogil);
+    def("disk_bench_async", &disk_bench_async, return_value_policy<manage_new_object>());
+    def("gear_fps", &gear_fps_nogil);
+    def("gear_fps_async", &gear_fps_async, return_value_policy<manage_new_object>());
+    def("gear_offscreen", &gear_offscreen_nogil);
+    def("gear_offscreen_async", &gear_offscreen_async, return_value_policy<manage_new_object>());
+    def("super_pi", &super_pi_nogil);
+    def("super_pi_async", &super_pi_async, return_value_policy<manage_new_object>());
+    def("cpu_hash", &cpu_nogil<cpu_hash>);
+    def("cpu_hash_async", &cpu_async<cpu_hash>, return_value_policy<manage_new_object>());
+    def("cpu_parse", &cpu_nogil<cpu_parse>);
+    def("cpu_parse_async", &cpu_async<cpu_parse>, return_value_policy<manage_new_object>());
+    def("cpu_sgemm", &cpu_nogil<cpu_sgemm>);
+    def("cpu_sgemm_async", &cpu_async<cpu_sgemm>, return_value_policy<manage_new_object>());
+    def("cpu_crc32", &cpu_nogil<cpu_crc32>);
+    def("cpu_crc32_async", &cpu_async<cpu_crc32>, return_value_policy<manage_new_object>());
+    def("cpu_aes", &cpu_nogil<cpu_aes>);
+    def("cpu_aes_async", &cpu_async<cpu_aes>, return_value_policy<manage_new_object>());
+    def("strip_bench", &strip_bench_nogil);
+    def("strip_bench_async", &strip_bench_async, return_value_policy<manage_new_object>());
     def("record_sign", &record_sign);
-    def("stream_triad", &stream_triad);
-}
\ No newline at end of file
+    def("stream_triad", &stream_triad_nogil);
+    def("stream_triad_async", &stream_triad_async, return_value_policy<manage_new_object>());
+    def("traced", &traced);
+    def("dmi_invalidate", &dmi_cache_invalidate);
+}
@@ -1,6 +1,10 @@
 #ifndef _LSHW_H_
 #define _LSHW_H_
 
+#include <pthread.h>
+#include <boost/function.hpp>
+#include "scancontext.h"
+
 class lshw
 {
 public:
@@ -9,11 +13,149 @@ public:
 
     void scan_device();
     string get_xml();
+    boost::python::list get_disks();
+
+    // options of this instance's scans, by name
+    void enable(const string & option);
+    void disable(const string & option);
+    bool enabled(const string & option);
+
+    // sysfs tree read by sysfs.cc (devices, modaliases), "" for the mounted one
+    void set_sysfs_root(const string & path);
+    string sysfs_root();
+
+    // runs without the GIL, in a thread started for the scan
+    bool scan();
+    // only the given classes and subsystems (all if empty), see restrict_scan()
+    bool scan_filtered(const vector < string > & classes, const vector < string > & subsystems);
+
+    // for the node proxies: locks the tree and returns it, NULL if it was rescanned
+    hwNode *acquire(unsigned long generation);
+    void release();
+    unsigned long generation() const { return scans; }
 
 private:
+    // runs in a thread of its own, see run_isolated()
+    static void scan_thread(void *call);
+
     hwNode *computer;
+    ScanContext context;
+    pthread_mutex_t busy;                         // held while the tree is scanned or read
+    unsigned long scans;
+};
+
+/*
+ * read-only view of one node of an lshw tree, addressed by the child
+ * indexes leading to it: it becomes invalid (RuntimeError) once the
+ * tree is scanned again
+ */
+class node
+{
+public:
+    node(boost::python::object owner, const vector < unsigned int > & path, unsigned long generation);
+
+    string id() const;
+    string hwclass() const;
+    string description() const;
+    string vendor() const;
+    string product() const;
+    string version() const;
+    string serial() const;
+    string date() const;
+    string slot() const;
+    string businfo() const;
+    string handle() const;
+    string physid() const;
+    string logicalname() const;
+    boost::python::list logicalnames() const;
+    unsigned long long size() const;
+    unsigned long long capacity() const;
+    unsigned long long clock() const;
+    unsigned int width() const;
+    bool claimed() const;
+    bool enabled() const;
+    boost::python::dict config() const;
+    boost::python::dict capabilities() const;
+    bool capable(const string & feature) const;
+
+    boost::python::object parent() const;
+    boost::python::list children() const;
+    unsigned int count() const;
+    boost::python::list nodes(const string & hwclass = "") const;
+
+    // nodes of the tree of owner, in document order, matching hwclass if not empty
+    static boost::python::list select(boost::python::object owner, const string & hwclass);
+    static boost::python::object find(boost::python::object owner, const string & what, const string & value);
+
+private:
+    friend class tree_access;
+
+    boost::python::object owner;
+    vector < unsigned int > path;
+    unsigned long generation;
+};
+
+// releases the Python GIL for as long as it is in scope
+class without_gil
+{
+public:
+    without_gil() : state(PyEval_SaveThread()) {}
+    ~without_gil() { PyEval_RestoreThread(state); }
+
+private:
+    PyThreadState *state;
+};
+
+/*
+ * a native call running in its own thread, returned by the *_async
+ * bindings: Python polls it with done(), blocks on wait() (which
+ * releases the GIL) or collects result()
+ */
+class task
+{
+public:
+    virtual ~task();
+
+    bool done();
+    bool wait(double timeout = -1);
+    boost::python::object result();
+
+protected:
+    task();
+    void start();
+    void join();
+
+    virtual void run() = 0;
+    virtual boost::python::object value() = 0;
+
+private:
+    static void *thread_main(void *);
+
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t finished_cond;
+    bool started;
+    bool finished;
+    string error;
+};
+
+template < class R > class call_task : public task
+{
+public:
+    // owner is kept alive until the task is destroyed
+    call_task(const boost::function < R () > & f, boost::python::object o = boost::python::object())
+        : call(f), owner(o) { start(); }
+    ~call_task() { join(); }
+
+private:
+    void run() { returned = call(); }
+    boost::python::object value() { return boost::python::object(returned); }
+
+    boost::function < R () > call;
+    boost::python::object owner;
+    R returned;
 };
 
 char *degree_sign();
 
-#endif
\ No newline at end of file
+#endif
@@ -6,7 +6,9 @@
 #include "dmi.h"
 #include "cpuinfo.h"
 #include "cpuid.h"
+#include "cputopology.h"
 #include "pci.h"
+#include "nvme.h"
 #include "pcmcia.h"
 #include "pcmcia-legacy.h"
 #include "scsi.h"
@@ -17,6 +19,121 @@
 #include "smp.h"
 #include "abi.h"
 #include "status.h"
+#include "osutils.h"
+
+#include <strings.h>
+
+/*
+ * hardware classes each prober can add to the tree or complete: when only
+ * some classes are visible, the probers that cannot contribute to them
+ * are skipped
+ */
+static const struct
+{
+    option_id test;
+    const char *classes;
+} contributions[] =
+{
+    { OPT_DMI, "system bus memory processor power address" },
+    { OPT_SMP, "processor bus" },
+    { OPT_MEMORY, "memory bus" },
+    { OPT_CPUINFO, "processor bus" },
+    { OPT_CPUID, "processor memory" },
+    { OPT_CPUTOPOLOGY, "processor memory bus" },
+    { OPT_PCI, "bridge bus storage network display multimedia communication input generic memory processor" },
+    { OPT_PCILEGACY, "bridge bus storage network display multimedia communication input generic memory processor" },
+    { OPT_NVME, "storage disk volume" },
+    { OPT_PCMCIA, "bridge bus" },
+    { OPT_PCMCIA_LEGACY, "bridge bus storage network display communication generic memory" },
+    { OPT_USB, "bus storage input multimedia communication printer generic" },
+    { OPT_SCSI, "storage disk tape volume processor generic" },
+    { OPT_SYSFS, "bus storage network display communication input generic memory" },
+    { OPT_NETWORK, "network" },
+    { OPT_CPUFREQ, "processor" },
+    { OPT_ABI, "system" },
+};
+
+// class of a node, class of the nodes it is attached to
+static const char *placements[][2] =
+{
+    { "volume", "disk" },
+    { "disk", "storage" },
+    { "tape", "storage" },
+};
+
+#define COUNT(table) (sizeof(table) / sizeof(table[0]))
+
+// visible, or what a visible node is attached to (volume -> disk -> storage)
+static bool contributes(const string & hwclass)
+{
+    if(visible(hwclass.c_str()))
+        return true;
+
+    for(unsigned int i = 0; i < COUNT(placements); i++)
+        if(hwclass == placements[i][1] && contributes(placements[i][0]))
+            return true;
+
+    return false;
+}
+
+static bool known_class(const string & hwclass)
+{
+    for(int c = hw::system; c <= hw::generic; c++)
+        if(strcasecmp(hwclass.c_str(), hwNode("", (hw::hwClass) c).getClassName()) == 0)
+            return true;
+
+    return false;
+}
+
+static bool needed(option_id test)
+{
+    if(!enabled(test))
+        return false;
+    if(!current_options().filtered())
+        return true;
+
+    for(unsigned int i = 0; i < COUNT(contributions); i++)
+        if(contributions[i].test == test)
+        {
+            vector < string > classes;
+
+            splitlines(contributions[i].classes, classes, ' ');
+            for(unsigned int j = 0; j < classes.size(); j++)
+                if(contributes(classes[j]))
+                    return true;
+            return false;
+        }
+
+    return true;
+}
+
+bool restrict_scan(options & settings, const vector < string > & classes, const vector < string > & subsystems)
+{
+    vector < bool > kept(COUNT(contributions), subsystems.size() == 0);
+
+    for(unsigned int i = 0; i < subsystems.size(); i++)
+    {
+        bool known = false;
+
+        for(unsigned int j = 0; j < COUNT(contributions); j++)
+            if(strcasecmp(subsystems[i].c_str(), option_name(contributions[j].test)) == 0)
+                known = kept[j] = true;
+        if(!known)
+            return false;
+    }
+
+    for(unsigned int i = 0; i < classes.size(); i++)
+        if(!known_class(classes[i]))
+            return false;
+
+    for(unsigned int i = 0; i < COUNT(contributions); i++)
+        if(!kept[i])
+            settings.disable(contributions[i].test);
+    for(unsigned int i = 0; i < classes.size(); i++)
+        settings.show(classes[i].c_str());
+
+    return true;
+}
 
 bool scan_system(hwNode & system)
 {
@@ -24,67 +141,76 @@ bool scan_system(hwNode & system)
 
     if(gethostname(hostname, sizeof(hostname)) == 0)
     {
-        hwNode computer(::enabled("output:sanitize") ? "computer" : hostname, hw::system);
+        hwNode computer(::enabled(OPT_OUTPUT_SANITIZE) ? "computer" : hostname, hw::system);
 
+        sysfs_reset();
         status("DMI");
-        if(enabled("dmi"))
+        if(needed(OPT_DMI))
             scan_dmi(computer);
         status("SMP");
-        if(enabled("smp"))
+        if(needed(OPT_SMP))
             scan_smp(computer);
         status("memory");
-        if(enabled("memory"))
+        if(needed(OPT_MEMORY))
             scan_memory(computer);
         status("/proc/cpuinfo");
-        if(enabled("cpuinfo"))
+        if(needed(OPT_CPUINFO))
             scan_cpuinfo(computer);
         status("CPUID");
-        if(enabled("cpuid"))
+        if(needed(OPT_CPUID))
             scan_cpuid(computer);
+        status("CPU topology");
+        if(needed(OPT_CPUTOPOLOGY))
+            scan_cputopology(computer);
         status("PCI (sysfs)");
-        if(enabled("pci"))
+        if(needed(OPT_PCI))
         {
             if(!scan_pci(computer))
             {
-                if(enabled("pcilegacy"))
+                if(needed(OPT_PCILEGACY))
                     scan_pci_legacy(computer);
             }
         }
         else
         {
             status("PCI (legacy)");
-            if(enabled("pcilegacy"))
+            if(needed(OPT_PCILEGACY))
                 scan_pci_legacy(computer);
         }
+        status("NVMe");
+        if(needed(OPT_NVME))
+            scan_nvme(computer);
         status("PCMCIA");
-        if(enabled("pcmcia"))
+        if(needed(OPT_PCMCIA))
             scan_pcmcia(computer);
         status("PCMCIA (legacy)");
-        if(enabled("pcmcia-legacy"))
+        if(needed(OPT_PCMCIA_LEGACY))
             scan_pcmcialegacy(computer);
-        status("kernel device tree (sysfs)");
-        if(enabled("sysfs"))
-            scan_sysfs(computer);
         status("USB");
-        if(enabled("usb"))
+        if(needed(OPT_USB))
             scan_usb(computer);
         status("SCSI");
-        if(enabled("scsi"))
+        if(needed(OPT_SCSI))
             scan_scsi(computer);
+        status("kernel device tree (sysfs)");
+        if(needed(OPT_SYSFS))
+            scan_sysfs(computer);
         status("Network interfaces");
-        if(enabled("network"))
+        if(needed(OPT_NETWORK))
             scan_network(computer);
         status("CPUFreq");
-        if(enabled("cpufreq"))
+        if(needed(OPT_CPUFREQ))
             scan_cpufreq(computer);
         status("ABI");
-        if(enabled("abi"))
+        if(needed(OPT_ABI))
             scan_abi(computer);
 
         if(computer.getDescription() == "")
             computer.setDescription("Computer");
         computer.assignPhysIds();
         computer.fixInconsistencies();
+        if(current_options().filtered())
+            computer.pruneInvisible();
 
         system = computer;
     }
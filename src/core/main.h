@@ -2,6 +2,14 @@
 #define _MAIN_H_
 
 #include "hw.h"
+#include "options.h"
 
 bool scan_system(hwNode & system);
+
+/*
+ * limits the scans done with settings to the given hardware classes and
+ * subsystems (prober option names, all of them if empty): false if a
+ * class or a subsystem is unknown
+ */
+bool restrict_scan(options & settings, const vector < string > & classes, const vector < string > & subsystems);
 #endif
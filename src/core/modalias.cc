@@ -0,0 +1,632 @@
+/*
+ * modalias.cc
+ *
+ * matching the devices against module aliases: the cost of a lookup is
+ * the length of the modalias plus one fnmatch() per candidate alias
+ * sharing its literal prefix, instead of one per alias of the database
+ */
+
+#include "modalias.h"
+#include "osutils.h"
+#include "hw.h"
+
+#include <ctype.h>
+#include <fnmatch.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#include <algorithm>
+
+#define INDEX_MAGIC "LSHWMA02"
+#define WILDCARDS "*?[\\"
+
+// the index file: header, alias records, package records, string pool
+struct index_header
+{
+    char magic[8];
+    u_int32_t aliases;
+    u_int32_t packages;
+    u_int32_t strings;                            // size of the string pool
+    u_int32_t reserved;
+};
+
+struct index_alias
+{
+    u_int32_t pattern;                            // offsets in the string pool
+    u_int32_t prefix;                             // length of the literal prefix of pattern
+    u_int32_t module;
+    u_int32_t package;                            // package record
+};
+
+struct index_package
+{
+    u_int32_t name;
+    u_int32_t version;
+    u_int32_t description;
+};
+
+// length of the part of pattern without wildcards
+static size_t literal_prefix(const string & pattern)
+{
+    size_t i = 0;
+
+    while((i < pattern.length()) && !strchr(WILDCARDS, pattern[i]))
+        i++;
+    return i;
+}
+
+alias_matcher::alias_matcher() : nodes(1)
+{
+}
+
+void alias_matcher::add(const string & pattern, const string & module, const string & package)
+{
+    size_t prefix = literal_prefix(pattern);
+    unsigned int n = 0;
+    alias a;
+
+    a.pattern = pattern;
+    a.module = module;
+    a.package = package;
+
+    for(size_t i = 0; i < prefix; i++)
+    {
+        map < char, unsigned int >::const_iterator next = nodes[n].next.find(pattern[i]);
+
+        if(next == nodes[n].next.end())
+        {
+            nodes[n].next[pattern[i]] = nodes.size();
+            n = nodes.size();
+            nodes.push_back(node());
+        }
+        else
+            n = next->second;
+    }
+
+    nodes[n].aliases.push_back(aliases.size());
+    aliases.push_back(a);
+}
+
+unsigned int alias_matcher::load(const string & path, const string & package)
+{
+    vector < string > lines;
+    unsigned int count = 0;
+
+    if(!loadfile(path, lines))
+        return 0;
+
+    for(unsigned int i = 0; i < lines.size(); i++)
+    {
+        vector < string > fields;
+
+        if(lines[i].compare(0, 6, "alias ") != 0)
+            continue;
+        splitlines(lines[i], fields, ' ');
+        if(fields.size() < 3)
+            continue;
+        add(fields[1], fields[2], package);
+        count++;
+    }
+
+    return count;
+}
+
+vector < pair < string, string > > alias_matcher::match(const string & modalias) const
+{
+    vector < pair < string, string > > result;
+    vector < unsigned int > candidates;
+    unsigned int n = 0;
+
+    for(size_t i = 0; ; i++)
+    {
+        map < char, unsigned int >::const_iterator next;
+
+        candidates.insert(candidates.end(), nodes[n].aliases.begin(), nodes[n].aliases.end());
+        if(i >= modalias.length())
+            break;
+        next = nodes[n].next.find(modalias[i]);
+        if(next == nodes[n].next.end())
+            break;
+        n = next->second;
+    }
+
+    // in the order the aliases were added
+    sort(candidates.begin(), candidates.end());
+    for(unsigned int i = 0; i < candidates.size(); i++)
+    {
+        const alias & a = aliases[candidates[i]];
+        pair < string, string > found(a.module, a.package);
+
+        if(fnmatch(a.pattern.c_str(), modalias.c_str(), 0) != 0)
+            continue;
+        if(find(result.begin(), result.end(), found) == result.end())
+            result.push_back(found);
+    }
+
+    return result;
+}
+
+map < string, vector < pair < string, string > > > alias_matcher::match(const vector < string > & modaliases) const
+{
+    map < string, vector < pair < string, string > > > result;
+
+    for(unsigned int i = 0; i < modaliases.size(); i++)
+        if(result.find(modaliases[i]) == result.end())
+            result[modaliases[i]] = match(modaliases[i]);
+
+    return result;
+}
+
+/*
+ * the driver catalogue, read the way parsexml.Parser did: text is taken
+ * line by line and belongs to the last start tag, any tag with a "name"
+ * attribute starts a package, and a <modaliases> line is
+ * "module(alias, alias...)"
+ */
+struct catalogue
+{
+    string tag;
+    string text;
+    driver_package package;
+
+    string pool;
+    map < string, u_int32_t > offsets;
+    map < string, u_int32_t > package_ids;
+    vector < index_package > packages;
+    vector < pair < string, index_alias > > aliases;  // by literal prefix
+};
+
+static u_int32_t intern(catalogue & c, const string & s)
+{
+    map < string, u_int32_t >::const_iterator known = c.offsets.find(s);
+    u_int32_t offset = c.pool.length();
+
+    if(known != c.offsets.end())
+        return known->second;
+
+    c.pool.append(s.c_str(), s.length() + 1);
+    c.offsets[s] = offset;
+    return offset;
+}
+
+static u_int32_t package_id(catalogue & c)
+{
+    string key = c.package.name + '\0' + c.package.version + '\0' + c.package.description;
+    map < string, u_int32_t >::const_iterator known = c.package_ids.find(key);
+    index_package p;
+
+    if(known != c.package_ids.end())
+        return known->second;
+
+    p.name = intern(c, c.package.name);
+    p.version = intern(c, c.package.version);
+    p.description = intern(c, c.package.description);
+    c.package_ids[key] = c.packages.size();
+    c.packages.push_back(p);
+    return c.packages.size() - 1;
+}
+
+/*
+ * only the aliases the driver lookup can key on: pci:v<vendor>d... and
+ * usb:v<vendor>p..., with 4 to 8 hex digits of literal vendor id
+ */
+static bool vendor_alias(const string & pattern)
+{
+    size_t digits = 0;
+
+    if((pattern.compare(0, 5, "pci:v") != 0) && (pattern.compare(0, 5, "usb:v") != 0))
+        return false;
+    while((5 + digits < pattern.length()) &&
+        (isdigit(pattern[5 + digits]) || ((pattern[5 + digits] >= 'A') && (pattern[5 + digits] <= 'F'))))
+        digits++;
+    if((digits < 4) || (digits > 8) || (5 + digits >= pattern.length()))
+        return false;
+    return (pattern[5 + digits] == 'd') || (pattern[5 + digits] == 'p');
+}
+
+static void catalogue_modaliases(catalogue & c, const string & line)
+{
+    size_t close = line.rfind(')');
+    size_t open = string::npos;
+    vector < string > patterns;
+    u_int32_t module = 0, package = 0;
+
+    if((close != string::npos) && (close >= 3))
+        open = line.rfind('(', close - 2);
+    if((open == string::npos) || (open == 0))
+        return;
+
+    module = intern(c, line.substr(0, open));
+    package = package_id(c);
+    splitlines(line.substr(open + 1, close - open - 1), patterns, ',');
+    for(unsigned int i = 0; i < patterns.size(); i++)
+    {
+        string pattern = hw::strip(patterns[i]);
+        index_alias a;
+
+        if(!vendor_alias(pattern))
+            continue;
+        a.pattern = intern(c, pattern);
+        a.prefix = literal_prefix(pattern);
+        a.module = module;
+        a.package = package;
+        c.aliases.push_back(make_pair(pattern.substr(0, a.prefix), a));
+    }
+}
+
+static void catalogue_text(catalogue & c)
+{
+    vector < string > lines;
+
+    splitlines(c.text, lines);
+    c.text = "";
+    for(unsigned int i = 0; i < lines.size(); i++)
+    {
+        string line = hw::strip(lines[i]);
+
+        if(line == "")
+            continue;
+        if(c.tag == "version")
+            c.package.version = line;
+        else if(c.tag == "description")
+            c.package.description = line;
+        else if(c.tag == "modaliases")
+            catalogue_modaliases(c, line);
+    }
+}
+
+// the predefined entities and character references
+static string unescape(const string & s)
+{
+    string result = "";
+
+    for(size_t i = 0; i < s.length(); i++)
+    {
+        size_t end = s.find(';', i);
+        string entity = "";
+
+        if((s[i] != '&') || (end == string::npos))
+        {
+            result += s[i];
+            continue;
+        }
+
+        entity = s.substr(i + 1, end - i - 1);
+        if(entity == "amp")
+            result += '&';
+        else if(entity == "lt")
+            result += '<';
+        else if(entity == "gt")
+            result += '>';
+        else if(entity == "quot")
+            result += '"';
+        else if(entity == "apos")
+            result += '\'';
+        else if((entity.length() > 1) && (entity[0] == '#'))
+        {
+            unsigned long code = (entity[1] == 'x') ? strtoul(entity.c_str() + 2, NULL, 16) : strtoul(entity.c_str() + 1, NULL, 10);
+
+            if(code < 0x80)
+                result += (char) code;
+            else if(code < 0x800)
+            {
+                result += (char) (0xc0 | (code >> 6));
+                result += (char) (0x80 | (code & 0x3f));
+            }
+            else
+            {
+                result += (char) (0xe0 | (code >> 12));
+                result += (char) (0x80 | ((code >> 6) & 0x3f));
+                result += (char) (0x80 | (code & 0x3f));
+            }
+        }
+        else
+        {
+            result += s[i];
+            continue;
+        }
+        i = end;
+    }
+
+    return result;
+}
+
+// "package name=\"foo\" arch='all'": the tag name, and the name attribute if any
+static void catalogue_tag(catalogue & c, const string & tag)
+{
+    size_t pos = tag.find_first_of(" \t\r\n/");
+
+    c.tag = tag.substr(0, pos);
+    while((pos = tag.find("name", pos)) != string::npos)
+    {
+        size_t equal = tag.find_first_not_of(" \t\r\n", pos + 4);
+        size_t quote = string::npos, end = string::npos;
+
+        if(!strchr(" \t\r\n", tag[pos - 1]) || (equal == string::npos) || (tag[equal] != '='))
+        {
+            pos += 4;
+            continue;
+        }
+        quote = tag.find_first_not_of(" \t\r\n", equal + 1);
+        if((quote == string::npos) || ((tag[quote] != '"') && (tag[quote] != '\'')))
+            break;
+        end = tag.find(tag[quote], quote + 1);
+        if(end == string::npos)
+            break;
+        c.package.name = unescape(tag.substr(quote + 1, end - quote - 1));
+        break;
+    }
+}
+
+// markup up to the closing '>', or the end of the comment or CDATA section
+static string read_markup(FILE *in)
+{
+    string markup = "";
+    char quote = 0;
+    int ch = 0;
+
+    while((ch = getc_unlocked(in)) != EOF)
+    {
+        if(!quote && (ch == '>'))
+        {
+            if((markup.compare(0, 3, "!--") == 0) && ((markup.length() < 5) || (markup.compare(markup.length() - 2, 2, "--") != 0)))
+                markup += ch;
+            else if((markup.compare(0, 8, "![CDATA[") == 0) && ((markup.length() < 10) || (markup.compare(markup.length() - 2, 2, "]]") != 0)))
+                markup += ch;
+            else
+                break;
+            continue;
+        }
+        if((ch == '"') || (ch == '\''))
+        {
+            if(!quote && (markup.length() > 0) && (markup[0] != '!'))
+                quote = ch;
+            else if(quote == ch)
+                quote = 0;
+        }
+        markup += ch;
+    }
+
+    return markup;
+}
+
+static bool parse_catalogue(FILE *in, catalogue & c)
+{
+    string raw = "";
+    int ch = 0;
+
+    while((ch = getc_unlocked(in)) != EOF)
+    {
+        string markup = "";
+
+        if(ch != '<')
+        {
+            raw += ch;
+            continue;
+        }
+
+        c.text += unescape(raw);
+        raw = "";
+        markup = read_markup(in);
+        if(markup.compare(0, 8, "![CDATA[") == 0)
+        {
+            c.text += markup.substr(8, markup.length() - 10);
+            continue;
+        }
+        catalogue_text(c);
+        if((markup == "") || (markup[0] == '/') || (markup[0] == '?') || (markup[0] == '!'))
+            continue;
+        catalogue_tag(c, markup);
+    }
+    c.text += unescape(raw);
+    catalogue_text(c);
+
+    return !ferror(in);
+}
+
+static bool by_prefix(const pair < string, index_alias > & a, const pair < string, index_alias > & b)
+{
+    return a.first < b.first;
+}
+
+long build_alias_index(const string & xml, const string & index)
+{
+    string temporary = index + "." + tostring(getpid());
+    FILE *in = fopen(xml.c_str(), "r");
+    FILE *out = NULL;
+    index_header header;
+    catalogue c;
+    bool ok = true;
+
+    if(!in)
+        return -1;
+    ok = parse_catalogue(in, c);
+    fclose(in);
+    if(!ok)
+        return -1;
+
+    stable_sort(c.aliases.begin(), c.aliases.end(), by_prefix);
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, INDEX_MAGIC, sizeof(header.magic));
+    header.aliases = c.aliases.size();
+    header.packages = c.packages.size();
+    header.strings = c.pool.length();
+
+    out = fopen(temporary.c_str(), "w");
+    if(!out)
+        return -1;
+    ok = fwrite(&header, sizeof(header), 1, out) == 1;
+    for(unsigned int i = 0; ok && i < c.aliases.size(); i++)
+        ok = fwrite(&c.aliases[i].second, sizeof(index_alias), 1, out) == 1;
+    if(ok && c.packages.size())
+        ok = fwrite(&c.packages[0], sizeof(index_package), c.packages.size(), out) == c.packages.size();
+    if(ok && c.pool.length())
+        ok = fwrite(c.pool.data(), c.pool.length(), 1, out) == 1;
+    ok = (fclose(out) == 0) && ok;
+
+    if(!ok || (rename(temporary.c_str(), index.c_str()) != 0))
+    {
+        unlink(temporary.c_str());
+        return -1;
+    }
+
+    return c.aliases.size();
+}
+
+alias_index::alias_index() : data(NULL), length(0), header(NULL), aliases(NULL), packages(NULL), strings(NULL)
+{
+}
+
+alias_index::~alias_index()
+{
+    close();
+}
+
+void alias_index::close()
+{
+    if(data)
+        munmap(data, length);
+    data = NULL;
+    length = 0;
+    header = NULL;
+    aliases = NULL;
+    packages = NULL;
+    strings = NULL;
+}
+
+unsigned int alias_index::size() const
+{
+    return header ? header->aliases : 0;
+}
+
+const char *alias_index::string_at(unsigned int offset) const
+{
+    return strings + offset;
+}
+
+bool alias_index::open(const string & path)
+{
+    struct stat buf;
+    unsigned long long expected = sizeof(index_header);
+    int fd = ::open(path.c_str(), O_RDONLY);
+
+    close();
+    if(fd < 0)
+        return false;
+    if((fstat(fd, &buf) != 0) || ((size_t) buf.st_size < sizeof(index_header)))
+    {
+        ::close(fd);
+        return false;
+    }
+
+    length = buf.st_size;
+    data = mmap(NULL, length, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if(data == MAP_FAILED)
+    {
+        data = NULL;
+        return false;
+    }
+
+    header = (const index_header *) data;
+    expected += (unsigned long long) header->aliases * sizeof(index_alias);
+    expected += (unsigned long long) header->packages * sizeof(index_package);
+    expected += header->strings;
+    if((memcmp(header->magic, INDEX_MAGIC, sizeof(header->magic)) != 0) || (expected != length)
+            || ((header->strings > 0) && (((const char *) data)[length - 1] != '\0')))
+    {
+        close();
+        return false;
+    }
+
+    aliases = (const index_alias *) (header + 1);
+    packages = (const index_package *) (aliases + header->aliases);
+    strings = (const char *) (packages + header->packages);
+
+    // every reference must stay inside the file
+    for(unsigned int i = 0; i < header->aliases; i++)
+        if((aliases[i].pattern >= header->strings) || (aliases[i].module >= header->strings)
+                || (aliases[i].package >= header->packages) || (aliases[i].prefix > strlen(string_at(aliases[i].pattern))))
+        {
+            close();
+            return false;
+        }
+    for(unsigned int i = 0; i < header->packages; i++)
+        if((packages[i].name >= header->strings) || (packages[i].version >= header->strings)
+                || (packages[i].description >= header->strings))
+        {
+            close();
+            return false;
+        }
+
+    return true;
+}
+
+vector < pair < string, driver_package > > alias_index::match(const string & modalias) const
+{
+    vector < pair < string, driver_package > > result;
+    vector < pair < u_int32_t, u_int32_t > > found;    // module, package
+    const index_alias *end = aliases + size();
+
+    for(size_t len = 0; header && len <= modalias.length(); len++)
+    {
+        const char *key = modalias.c_str();
+        const index_alias *lo = aliases, *hi = end;
+
+        // first record whose prefix is not below the first len characters
+        while(lo < hi)
+        {
+            const index_alias *mid = lo + (hi - lo) / 2;
+            int cmp = strncmp(string_at(mid->pattern), key, mid->prefix < len ? mid->prefix : len);
+
+            if((cmp < 0) || ((cmp == 0) && (mid->prefix < len)))
+                lo = mid + 1;
+            else
+                hi = mid;
+        }
+
+        // no prefix starts with these characters, so none with more of them
+        if((lo == end) || (lo->prefix < len) || (strncmp(string_at(lo->pattern), key, len) != 0))
+            break;
+
+        for(; (lo < end) && (lo->prefix == len) && (strncmp(string_at(lo->pattern), key, len) == 0); lo++)
+        {
+            pair < u_int32_t, u_int32_t > m(lo->module, lo->package);
+
+            if(fnmatch(string_at(lo->pattern), key, 0) != 0)
+                continue;
+            if(find(found.begin(), found.end(), m) != found.end())
+                continue;
+            found.push_back(m);
+        }
+    }
+
+    for(unsigned int i = 0; i < found.size(); i++)
+    {
+        driver_package p;
+
+        p.name = string_at(packages[found[i].second].name);
+        p.version = string_at(packages[found[i].second].version);
+        p.description = string_at(packages[found[i].second].description);
+        result.push_back(make_pair(string(string_at(found[i].first)), p));
+    }
+
+    return result;
+}
+
+map < string, vector < pair < string, driver_package > > > alias_index::match(const vector < string > & modaliases) const
+{
+    map < string, vector < pair < string, driver_package > > > result;
+
+    for(unsigned int i = 0; i < modaliases.size(); i++)
+        if(result.find(modaliases[i]) == result.end())
+            result[modaliases[i]] = match(modaliases[i]);
+
+    return result;
+}
@@ -0,0 +1,99 @@
+#ifndef _MODALIAS_H_
+#define _MODALIAS_H_
+
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+using namespace std;
+
+/*
+ * kernel-style module aliases ("pci:v00008086d*sv*sd*bc02sc00i*", as in
+ * modules.alias) compiled into a trie of their literal prefixes: a
+ * modalias is only fnmatch()ed against the patterns whose prefix it
+ * starts with
+ */
+class alias_matcher
+{
+  public:
+    alias_matcher();
+
+    void add(const string & pattern, const string & module, const string & package = "");
+    // "alias <pattern> <module>" lines, number of aliases read
+    unsigned int load(const string & path, const string & package = "");
+    unsigned int size() const { return aliases.size(); }
+
+    // (module, package) pairs matching modalias, without duplicates
+    vector < pair < string, string > > match(const string & modalias) const;
+    // the same for every modalias
+    map < string, vector < pair < string, string > > > match(const vector < string > & modaliases) const;
+
+  private:
+    struct alias
+    {
+      string pattern;
+      string module;
+      string package;
+    };
+
+    struct node
+    {
+      map < char, unsigned int > next;
+      vector < unsigned int > aliases;
+    };
+
+    vector < alias > aliases;
+    vector < node > nodes;
+};
+
+struct driver_package
+{
+    string name;
+    string version;
+    string description;
+};
+
+/*
+ * the aliases of the driver catalogue (driver.xml) as written by
+ * build_alias_index(), mapped read-only: the records are sorted by the
+ * literal prefix of their pattern, so a lookup is a binary search per
+ * prefix of the modalias
+ */
+class alias_index
+{
+  public:
+    alias_index();
+    ~alias_index();
+
+    // false if path is missing or is not a valid index
+    bool open(const string & path);
+    void close();
+    unsigned int size() const;
+
+    // (module, package) pairs matching modalias, without duplicates
+    vector < pair < string, driver_package > > match(const string & modalias) const;
+    map < string, vector < pair < string, driver_package > > > match(const vector < string > & modaliases) const;
+
+  private:
+    alias_index(const alias_index &);
+    alias_index & operator =(const alias_index &);
+
+    const char *string_at(unsigned int offset) const;
+
+    void *data;
+    size_t length;
+    const struct index_header *header;
+    const struct index_alias *aliases;
+    const struct index_package *packages;
+    const char *strings;
+};
+
+/*
+ * converts the driver catalogue in one streaming pass, replacing index
+ * atomically; only pci/usb aliases with a literal vendor id are kept:
+ * number of aliases written, -1 if xml can't be read or index can't be
+ * written
+ */
+long build_alias_index(const string & xml, const string & index);
+#endif
@@ -254,7 +254,7 @@ static void scan_ip(hwNode & interface)
         if(ioctl(fd, SIOCGIFADDR, &ifr) == 0)
         {
             // IP address is in ifr.ifr_addr
-            interface.setConfig("ip", ::enabled("output:sanitize") ? REMOVED : print_ip((sockaddr_in *) (&ifr.ifr_addr)));
+            interface.setConfig("ip", ::enabled(OPT_OUTPUT_SANITIZE) ? REMOVED : print_ip((sockaddr_in *) (&ifr.ifr_addr)));
             strcpy(ifr.ifr_name, interface.getLogicalName().c_str());
             if((interface.getConfig("point-to-point") == "yes")
                     && (ioctl(fd, SIOCGIFDSTADDR, &ifr) == 0))
@@ -0,0 +1,294 @@
+/*
+ * nvme.cc
+ *
+ * NVMe controllers and namespaces from /sys/class/nvme, optionally
+ * completed with Identify Controller / Identify Namespace admin commands
+ * (option "nvme:identify", needs root).
+ */
+
+#include "nvme.h"
+#include "disk.h"
+#include "osutils.h"
+#include "options.h"
+#include <sys/types.h>
+#include <sys/ioctl.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <string>
+#include <vector>
+
+#define SYSFS_NVME "/sys/class/nvme"
+#define SYSFS_BLOCK "/sys/block"
+
+#define NVME_ADMIN_IDENTIFY 0x06
+#define NVME_ID_CNS_NS 0x00
+#define NVME_ID_CNS_CTRL 0x01
+#define NVME_IDENTIFY_LEN 4096
+#define NVME_ADMIN_TIMEOUT 5000                   /* 5 seconds */
+
+/* same layout as struct nvme_admin_cmd in <linux/nvme_ioctl.h> */
+typedef struct my_nvme_admin_cmd
+{
+    u_int8_t opcode;
+    u_int8_t flags;
+    u_int16_t rsvd1;
+    u_int32_t nsid;
+    u_int32_t cdw2;
+    u_int32_t cdw3;
+    u_int64_t metadata;
+    u_int64_t addr;
+    u_int32_t metadata_len;
+    u_int32_t data_len;
+    u_int32_t cdw10;
+    u_int32_t cdw11;
+    u_int32_t cdw12;
+    u_int32_t cdw13;
+    u_int32_t cdw14;
+    u_int32_t cdw15;
+    u_int32_t timeout_ms;
+    u_int32_t result;
+}
+My_nvme_admin_cmd;
+
+#ifndef NVME_IOCTL_ADMIN_CMD
+#define NVME_IOCTL_ADMIN_CMD _IOWR('N', 0x41, My_nvme_admin_cmd)
+#endif
+
+static bool nvme_identify(int fd, u_int32_t nsid, u_int32_t cns, unsigned char *data)
+{
+    My_nvme_admin_cmd cmd;
+
+    memset(&cmd, 0, sizeof(cmd));
+    memset(data, 0, NVME_IDENTIFY_LEN);
+    cmd.opcode = NVME_ADMIN_IDENTIFY;
+    cmd.nsid = nsid;
+    cmd.addr = (u_int64_t) (unsigned long) data;
+    cmd.data_len = NVME_IDENTIFY_LEN;
+    cmd.cdw10 = cns;
+    cmd.timeout_ms = NVME_ADMIN_TIMEOUT;
+
+    return ioctl(fd, NVME_IOCTL_ADMIN_CMD, &cmd) == 0;
+}
+
+static u_int32_t le32(const unsigned char *p)
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((u_int32_t) p[3] << 24);
+}
+
+static u_int64_t le64(const unsigned char *p)
+{
+    return le32(p) | ((u_int64_t) le32(p + 4) << 32);
+}
+
+static string nvme_businfo(int controller, int ns = -1)
+{
+    string result = "nvme@" + tostring(controller);
+
+    if(ns >= 0)
+        result += ":" + tostring(ns);
+
+    return result;
+}
+
+// Identify Controller: serial number, model, firmware revision
+static void identify_controller(int fd, hwNode & n)
+{
+    unsigned char data[NVME_IDENTIFY_LEN];
+
+    if(!nvme_identify(fd, 0, NVME_ID_CNS_CTRL, data))
+        return;
+
+    n.setSerial(hw::strip(string((char *) data + 4, 20)));
+    n.setProduct(hw::strip(string((char *) data + 24, 40)));
+    n.setVersion(hw::strip(string((char *) data + 64, 8)));
+    n.setConfig("namespaces", le32(data + 516));
+}
+
+// Identify Namespace: capacity and supported LBA formats
+static void identify_namespace(int fd, u_int32_t nsid, hwNode & n)
+{
+    unsigned char data[NVME_IDENTIFY_LEN];
+    unsigned int nlbaf = 0, flbas = 0;
+    string formats = "";
+
+    if(!nvme_identify(fd, nsid, NVME_ID_CNS_NS, data))
+        return;
+
+    nlbaf = data[25] + 1;
+    flbas = data[26] & 0xf;
+    if(nlbaf > 16)
+        nlbaf = 16;
+
+    for(unsigned int i = 0; i < nlbaf; i++)
+    {
+        u_int32_t lbaf = le32(data + 128 + 4 * i);
+        unsigned int ms = lbaf & 0xffff;
+        unsigned int lbads = (lbaf >> 16) & 0xff;
+        string format;
+
+        if(lbads < 9 || lbads > 31)
+            continue;
+
+        format = tostring(1ULL << lbads);
+        if(ms)
+            format += "+" + tostring(ms);
+        if(formats != "")
+            formats += " ";
+        formats += format;
+
+        if(i == flbas)
+        {
+            n.setConfig("lbaformat", format);
+            n.setConfig("logicalsectorsize", 1ULL << lbads);
+            n.setSize(le64(data) << lbads);
+        }
+    }
+
+    if(formats != "")
+        n.setConfig("lbaformats", formats);
+}
+
+static hwNode *controller_parent(hwNode & n, const string & transport, const string & address)
+{
+    hwNode *parent = NULL;
+
+    if(transport == "pcie" && address != "")
+        parent = n.findChildByBusInfo("pci@" + address);
+    if(parent)
+        return parent;
+
+    if(hwNode *core = n.getChild("core"))
+        return core->addChild(hwNode("nvme", hw::storage));
+
+    return n.addChild(hwNode("nvme", hw::storage));
+}
+
+static void scan_namespace(const string & name, int controller, int fd, hwNode & parent)
+{
+    string block = string(SYSFS_BLOCK) + "/" + name;
+    string nsid, logical;
+    int sub = -1, ns = -1, path = -1;
+    unsigned long long sectors = 0;
+    hwNode namespc("namespace", hw::disk);
+
+    // "nvme0n1", or "nvme0c0n1" for a path of a multipath namespace
+    if(sscanf(name.c_str(), "nvme%dc%dn%d", &sub, &path, &ns) == 3)
+        block = string(SYSFS_BLOCK) + "/nvme" + tostring(sub) + "n" + tostring(ns);
+    else if(sscanf(name.c_str(), "nvme%dn%d", &sub, &ns) != 2)
+        return;
+
+    nsid = get_string(block + "/nsid");
+    if(nsid != "")
+        ns = atoi(nsid.c_str());
+
+    namespc.setDescription("NVMe namespace");
+    namespc.setBusInfo(nvme_businfo(controller, ns));
+    namespc.setPhysId(ns);
+    namespc.setLogicalName("/dev/" + string(strrchr(block.c_str(), '/') + 1));
+
+    sectors = strtoull(get_string(block + "/size", "0").c_str(), NULL, 10);
+    if(sectors)
+        namespc.setSize(sectors * 512);   // always 512-byte units in sysfs
+    logical = get_string(block + "/queue/logical_block_size");
+    if(logical != "")
+        namespc.setConfig("logicalsectorsize", logical);
+
+    if(fd >= 0)
+        identify_namespace(fd, ns, namespc);
+
+    scan_disk(namespc);
+    namespc.claim();
+    parent.addChild(namespc);
+}
+
+static void scan_controller(const string & name, hwNode & n)
+{
+    string path = string(SYSFS_NVME) + "/" + name;
+    string transport = get_string(path + "/transport");
+    string address = get_string(path + "/address");
+    string model, serial, firmware, state, numa, sqsize;
+    vector < string > entries = list_dir(path);
+    hwNode *controller = NULL;
+    unsigned long queues = 0;
+    int number = -1;
+    int fd = -1;
+
+    if(sscanf(name.c_str(), "nvme%d", &number) != 1)
+        return;
+
+    controller = controller_parent(n, transport, address);
+    if(!controller)
+        return;
+
+    controller->setDescription("NVMe device");
+    controller->setLogicalName("/dev/" + name);
+    controller->setBusInfo(controller->getBusInfo() == "" ? nvme_businfo(number) : controller->getBusInfo());
+    controller->addCapability("nvme", "NVMe interface");
+    model = hw::strip(get_string(path + "/model"));
+    if(model != "")
+        controller->setProduct(model);
+    serial = hw::strip(get_string(path + "/serial"));
+    if(serial != "")
+        controller->setSerial(serial);
+    firmware = hw::strip(get_string(path + "/firmware_rev"));
+    if(firmware != "")
+        controller->setVersion(firmware);
+    if(transport != "")
+        controller->setConfig("transport", transport);
+    state = get_string(path + "/state");
+    if(state != "")
+        controller->setConfig("state", state);
+    numa = get_string(path + "/device/numa_node", "-1");
+    if(numa != "-1")
+        controller->setConfig("numa_node", numa);
+
+    // queue_count includes the admin queue
+    queues = strtoul(get_string(path + "/queue_count", "0").c_str(), NULL, 10);
+    if(queues > 1)
+        controller->setConfig("ioqueues", queues - 1);
+    sqsize = get_string(path + "/sqsize");
+    if(sqsize != "")
+        controller->setConfig("queuesize", sqsize);
+
+    if(enabled(OPT_NVME_IDENTIFY))
+    {
+        fd = open(("/dev/" + name).c_str(), O_RDONLY);
+        if(fd >= 0)
+            identify_controller(fd, *controller);
+    }
+
+    for(unsigned int i = 0; i < entries.size(); i++)
+        if(entries[i].compare(0, name.length(), name) == 0 && entries[i].length() > name.length()
+                && (entries[i][name.length()] == 'n' || entries[i][name.length()] == 'c'))
+            scan_namespace(entries[i], number, fd, *controller);
+
+    // no sysfs queue_count on older kernels: count the blk-mq hardware queues
+    for(unsigned int i = 0; queues == 0 && i < controller->countChildren(); i++)
+    {
+        string block = controller->getChild(i)->getLogicalName();
+
+        if(controller->getChild(i)->getClass() != hw::disk || block == "")
+            continue;
+        queues = list_dir(string(SYSFS_BLOCK) + "/" + block.substr(block.rfind('/') + 1) + "/mq").size();
+        if(queues > 0)
+            controller->setConfig("ioqueues", queues);
+    }
+
+    if(fd >= 0)
+        close(fd);
+    controller->claim();
+}
+
+bool scan_nvme(hwNode & n)
+{
+    vector < string > controllers = list_dir(SYSFS_NVME);
+
+    for(unsigned int i = 0; i < controllers.size(); i++)
+        scan_controller(controllers[i], n);
+
+    return controllers.size() > 0;
+}
@@ -6,6 +6,7 @@
  */
 
 #include "options.h"
+#include "scancontext.h"
 #include "osutils.h"
 
 #include <set>
@@ -14,12 +15,37 @@
 #include <map>
 
 #include <stdlib.h>
+#include <strings.h>
 
 using namespace std;
 
+static const char *option_names[OPT_COUNT] =
+{
+    "dmi",
+    "dmi:cache",
+    "smp",
+    "memory",
+    "cpuinfo",
+    "cpuid",
+    "cputopology",
+    "pci",
+    "pcilegacy",
+    "nvme",
+    "nvme:identify",
+    "pcmcia",
+    "pcmcia-legacy",
+    "sysfs",
+    "usb",
+    "scsi",
+    "network",
+    "cpufreq",
+    "abi",
+    "disk:open",
+    "output:numeric",
+    "output:sanitize",
+    "output:list",
+};
 
-static set < string > disabled_tests;
-static set < string > visible_classes;
 static map < string, string > aliases;
 
 static string getcname(const char * aname)
@@ -30,32 +56,96 @@ static string getcname(const char * aname)
         return lowercase(aname);
 }
 
+static int option_id_byname(const char *option)
+{
+    for(int i = 0; i < OPT_COUNT; i++)
+        if(strcasecmp(option, option_names[i]) == 0)
+            return i;
+    return -1;
+}
+
+bool options::enabled(const char *option) const
+{
+    int id = option_id_byname(option);
+
+    if(id >= 0)
+        return enabled((option_id) id);
+    return disabled_names.find(lowercase(option)) == disabled_names.end();
+}
+
+void options::enable(const char *option)
+{
+    int id = option_id_byname(option);
+
+    if(id >= 0)
+        enable((option_id) id);
+    else
+        disabled_names.erase(lowercase(option));
+}
+
+void options::disable(const char *option)
+{
+    int id = option_id_byname(option);
+
+    if(id >= 0)
+        disable((option_id) id);
+    else
+        disabled_names.insert(lowercase(option));
+}
+
+bool options::visible(const char *c) const
+{
+    if(visible_classes.size() == 0)
+        return true;
+    return visible_classes.find(getcname(c)) != visible_classes.end();
+}
+
+void options::show(const char *c)
+{
+    visible_classes.insert(getcname(c));
+}
+
+options & default_options()
+{
+    return default_context().settings;
+}
+
+const options & current_options()
+{
+    return scan_settings();
+}
+
+bool enabled(option_id id)
+{
+    return current_options().enabled(id);
+}
+
 bool enabled(const char *option)
 {
-    return !(disabled(lowercase(option).c_str()));
+    return current_options().enabled(option);
 }
 
 bool disabled(const char *option)
 {
-    return disabled_tests.find(lowercase(option)) != disabled_tests.end();
+    return !current_options().enabled(option);
 }
 
 void enable(const char *option)
 {
-    if(!disabled(option))
-        return;
-
-    disabled_tests.erase(lowercase(option));
+    default_options().enable(option);
 }
 
 void disable(const char *option)
 {
-    disabled_tests.insert(lowercase(option));
+    default_options().disable(option);
 }
 
 bool visible(const char *c)
 {
-    if(visible_classes.size() == 0)
-        return true;
-    return visible_classes.find(getcname(c)) != visible_classes.end();
+    return current_options().visible(c);
+}
+
+const char *option_name(option_id id)
+{
+    return option_names[id];
 }
@@ -1,8 +1,77 @@
 #ifndef _OPTIONS_H_
 #define _OPTIONS_H_
 
+#include <bitset>
+#include <set>
+#include <string>
+
 #define REMOVED "[REMOVED]"
 
+/*
+ * tests and output settings known at compile time, in the same order as
+ * option_names[] in options.cc
+ */
+typedef enum
+{
+  OPT_DMI,
+  OPT_DMI_CACHE,
+  OPT_SMP,
+  OPT_MEMORY,
+  OPT_CPUINFO,
+  OPT_CPUID,
+  OPT_CPUTOPOLOGY,
+  OPT_PCI,
+  OPT_PCILEGACY,
+  OPT_NVME,
+  OPT_NVME_IDENTIFY,
+  OPT_PCMCIA,
+  OPT_PCMCIA_LEGACY,
+  OPT_SYSFS,
+  OPT_USB,
+  OPT_SCSI,
+  OPT_NETWORK,
+  OPT_CPUFREQ,
+  OPT_ABI,
+  OPT_DISK_OPEN,
+  OPT_OUTPUT_NUMERIC,
+  OPT_OUTPUT_SANITIZE,
+  OPT_OUTPUT_LIST,
+  OPT_COUNT
+} option_id;
+
+/*
+ * the options of one scan: everything is enabled unless disabled. Names
+ * without an ID (e.g. "sysfs:<bus>") are kept as strings.
+ */
+class options
+{
+  public:
+    bool enabled(option_id id) const { return !disabled_ids.test(id); }
+    void enable(option_id id) { disabled_ids.reset(id); }
+    void disable(option_id id) { disabled_ids.set(id); }
+
+    // string forms, for names coming from the command line or Python
+    bool enabled(const char * option) const;
+    void enable(const char * option);
+    void disable(const char * option);
+
+    // classes kept in the tree and the output, all of them until one is shown
+    bool visible(const char * c) const;
+    void show(const char * c);
+    void show_all() { visible_classes.clear(); }
+    bool filtered() const { return visible_classes.size() > 0; }
+
+  private:
+    std::bitset < OPT_COUNT > disabled_ids;
+    std::set < std::string > disabled_names;
+    std::set < std::string > visible_classes;
+};
+
+// options of the calling thread's scan, and the process-wide defaults
+const options & current_options();
+options & default_options();
+
+bool enabled(option_id id);
 bool enabled(const char * option);
 bool disabled(const char * option);
 void enable(const char * option);
@@ -10,4 +79,6 @@ void disable(const char * option);
 
 bool visible(const char * c);
 
+const char *option_name(option_id id);
+
 #endif
@@ -1,7 +1,9 @@
 #include "osutils.h"
+#include "scancontext.h"
 #include <sstream>
 #include <iomanip>
 #include <stack>
+#include <algorithm>
 #include <fcntl.h>
 #include <sys/stat.h>
 #include <unistd.h>
@@ -18,14 +20,16 @@
 #ifndef MINOR
 #include <linux/kdev_t.h>
 #endif
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 
 
 using namespace std;
 
-static stack < string > dirs;
-
 bool pushd(const string & dir)
 {
+    stack < string > & dirs = scan_context().dirs;
     string curdir = pwd();
 
     if(dir == "")
@@ -54,6 +58,7 @@ bool pushd(const string & dir)
 
 string popd()
 {
+    stack < string > & dirs = scan_context().dirs;
     string curdir = pwd();
 
     if(dirs.size() == 0)
@@ -126,6 +131,43 @@ bool loadfile(const string & file,
     return true;
 }
 
+// first line of a small file such as a sysfs attribute
+string get_string(const string & path, const string & def)
+{
+    char buffer[4096];
+    ssize_t count = 0;
+    int fd = open(path.c_str(), O_RDONLY);
+
+    if(fd < 0)
+        return def;
+
+    count = read(fd, buffer, sizeof(buffer) - 1);
+    close(fd);
+    if(count < 0)
+        return def;
+
+    buffer[count] = '\0';
+    return string(buffer, strcspn(buffer, "\n"));
+}
+
+// sorted directory entries, without "." and hidden files
+vector < string > list_dir(const string & path)
+{
+    vector < string > result;
+    DIR *dir = opendir(path.c_str());
+    struct dirent *d;
+
+    if(!dir)
+        return result;
+    while((d = readdir(dir)) != NULL)
+        if(d->d_name[0] != '.')
+            result.push_back(d->d_name);
+    closedir(dir);
+    sort(result.begin(), result.end());
+
+    return result;
+}
+
 int selectdir(const struct dirent *d)
 {
     struct stat buf;
@@ -352,74 +394,116 @@ int open_dev(dev_t dev, const string & name)
 // U+FFFD replacement character
 #define REPLACEMENT  "\357\277\275"
 
-string utf8_sanitize(const string & s)
+/*
+ * true if [s, s+len) needs no sanitizing: plain ASCII, and no control
+ * characters when these are to be dropped
+ */
+static bool utf8_plain(const char *s, size_t len, bool controls)
 {
-    unsigned int i = 0;
-    unsigned int remaining = 0;
-    string result = "";
-    string emit = "";
-    unsigned char c = 0;
+    size_t i = 0;
+
+#if defined(__SSE2__)
+    const __m128i space = _mm_set1_epi8(' ');
+
+    // signed compare: bytes >= 0x80 are negative, hence also "< ' '"
+    for(; i + 16 <= len; i += 16)
+    {
+        __m128i v = _mm_loadu_si128((const __m128i *) (s + i));
+        int mask = controls ? _mm_movemask_epi8(v) : _mm_movemask_epi8(_mm_cmplt_epi8(v, space));
+
+        if(mask)
+            return false;
+    }
+#endif
 
-    while(i < s.length())
+    for(; i < len; i++)
+        if(((unsigned char) s[i] >= 0x80) || (!controls && ((unsigned char) s[i] < ' ')))
+            return false;
+
+    return true;
+}
+
+/*
+ * invalid bytes and sequences are replaced with U+FFFD, a sequence
+ * truncated by the end of the string is dropped; control characters are
+ * dropped too unless controls is set
+ */
+string utf8_sanitize(const char *s, size_t len, bool controls)
+{
+    string result;
+    size_t i = 0;
+
+    if(utf8_plain(s, len, controls))
+        return string(s, len);
+
+    result.reserve(len + sizeof(REPLACEMENT));
+    while(i < len)
     {
-        c = s[i];
-        switch(remaining)
+        unsigned char c = s[i];
+        size_t run = i;
+        size_t need = 0;
+        size_t got = 0;
+        size_t next = i + 1;
+        char sequence[4];
+
+        // copy runs of ASCII at once
+        while((run < len) && ((unsigned char) s[run] < 0x80) &&
+            (controls || ((unsigned char) s[run] >= ' ')))
+            run++;
+        if(run > i)
         {
-            case 3:
-            case 2:
-            case 1:
-                if((0x80 <= c) && (c <= 0xbf))
-                {
-                    emit += s[i];
-                    remaining--;
-                }
-                else // invalid sequence (truncated)
-                {
-                    emit = REPLACEMENT;
-                    emit += s[i];
-                    remaining = 0;
-                }
-                break;
+            result.append(s + i, run - i);
+            i = run;
+            continue;
+        }
+
+        if(c < 0x80)                              // dropped control character
+        {
+            i++;
+            continue;
+        }
+
+        if((0xc2 <= c) && (c <= 0xdf))            // start 2-byte sequence
+            need = 1;
+        else if((0xe0 <= c) && (c <= 0xef))       // start 3-byte sequence
+            need = 2;
+        else if((0xf0 <= c) && (c <= 0xf4))       // start 4-byte sequence
+            need = 3;
+        else                                      // invalid character
+        {
+            result += REPLACEMENT;
+            i++;
+            continue;
+        }
 
-            case 0:
-                result += emit;
-                emit = "";
-
-                if(c <= 0x7f)
-                    emit = s[i];
-                else
-                    if((0xc2 <= c) && (c <= 0xdf)) // start 2-byte sequence
-                {
-                    remaining = 1;
-                    emit = s[i];
-                }
-                else
-                    if((0xe0 <= c) && (c <= 0xef)) // start 3-byte sequence
-                {
-                    remaining = 2;
-                    emit = s[i];
-                }
-                else
-                    if((0xf0 <= c) && (c <= 0xf4)) // start 4-byte sequence
-                {
-                    remaining = 3;
-                    emit = s[i];
-                }
-                else
-                    emit = REPLACEMENT; // invalid character
+        sequence[0] = c;
+        for(next = i + 1; (got < need) && (next < len); next++)
+        {
+            unsigned char d = s[next];
 
+            if(!controls && (d < ' '))            // dropped, doesn't break the sequence
+                continue;
+            if((d & 0xc0) != 0x80)
                 break;
+            sequence[++got] = d;
         }
 
-        i++;
+        if(got == need)
+            result.append(sequence, need + 1);
+        else if(next < len)                       // invalid sequence (truncated)
+            result += REPLACEMENT;
+        // else: truncated by the end of the string, dropped
+        i = next;
     }
 
-    if(remaining == 0)
-        result += emit;
-
     return result;
 }
 
+string utf8_sanitize(const string & s)
+{
+    return utf8_sanitize(s.data(), s.length(), true);
+}
+
 string platform()
 {
     string p = "";
@@ -15,6 +15,8 @@ bool samefile(const std::string & path1, const std::string & path2);
 std::string readlink(const std::string & path);
 std::string realpath(const std::string & path);
 bool loadfile(const std::string & file, std::vector < std::string > &lines);
+std::string get_string(const std::string & path, const std::string & def = "");
+std::vector < std::string > list_dir(const std::string & path);
 
 size_t splitlines(const std::string & s,
 std::vector < std::string > &lines,
@@ -27,6 +29,7 @@ std::string lowercase(const std::string &);
 std::string tostring(unsigned long long);
 std::string tohex(unsigned long long);
 std::string utf8_sanitize(const std::string &);
+std::string utf8_sanitize(const char *, size_t, bool controls = true);
 
 std::string spaces(unsigned int count, const std::string & space = " ");
 std::string escape(const std::string &);
@@ -1,6 +1,7 @@
 #include "pci.h"
 #include "osutils.h"
 #include "options.h"
+#include "scancontext.h"
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
@@ -191,8 +192,6 @@
 #define PCI_CB_SUBSYSTEM_VENDOR_ID 0x40
 #define PCI_CB_SUBSYSTEM_ID     0x42
 
-bool pcidb_loaded = false;
-
 typedef unsigned long long pciaddr_t;
 
 typedef enum
@@ -241,8 +240,24 @@ struct pci_entry
             long u4 = -1);
 };
 
-static vector < pci_entry > pci_devices;
-static vector < pci_entry > pci_classes;
+// pci.ids, loaded once per scan context
+struct pci_state : public scan_state
+{
+    pci_state() : loaded(false) {}
+
+    bool loaded;
+    vector < pci_entry > devices;
+    vector < pci_entry > classes;
+};
+
+static pci_state & pcidb()
+{
+    ScanContext & context = scan_context();
+
+    if(!context.pci)
+        context.pci = new pci_state;
+    return *static_cast < pci_state * >(context.pci);
+}
 
 pci_entry::pci_entry(const string & d,
         long u1,
@@ -487,11 +502,11 @@ static bool parse_pcidb(vector < string > &list)
         if((current_catalog == pciclass) ||
                 (current_catalog == pcisubclass) || (current_catalog == pciprogif))
         {
-            pci_classes.push_back(pci_entry(line, u[0], u[1], u[2], u[3]));
+            pcidb().classes.push_back(pci_entry(line, u[0], u[1], u[2], u[3]));
         }
         else
         {
-            pci_devices.push_back(pci_entry(line, u[0], u[1], u[2], u[3]));
+            pcidb().devices.push_back(pci_entry(line, u[0], u[1], u[2], u[3]));
         }
     }
     return true;
@@ -521,7 +536,7 @@ static string get_class_description(long c,
 {
     pci_entry result("");
 
-    if(find_best_match(pci_classes, result, c >> 8, c & 0xff, pi))
+    if(find_best_match(pcidb().classes, result, c >> 8, c & 0xff, pi))
         return result.description;
     else
         return "";
@@ -534,7 +549,7 @@ static string get_device_description(long u1,
 {
     pci_entry result("");
 
-    if(find_best_match(pci_devices, result, u1, u2, u3, u4))
+    if(find_best_match(pcidb().devices, result, u1, u2, u3, u4))
         return result.description;
     else
         return "";
@@ -681,8 +696,8 @@ static hwNode *scan_pci_dev(struct pci_dev &d, hwNode & n)
         core = n.getChild("core");
     }
 
-    if(!pcidb_loaded)
-        pcidb_loaded = load_pcidb();
+    if(!pcidb().loaded)
+        pcidb().loaded = load_pcidb();
 
     d.vendor_id = get_conf_word(d, PCI_VENDOR_ID);
     d.device_id = get_conf_word(d, PCI_DEVICE_ID);
@@ -723,8 +738,8 @@ static hwNode *scan_pci_dev(struct pci_dev &d, hwNode & n)
         hwNode host("pci", hw::bridge);
 
         host.setDescription(get_class_description(dclass, progif));
-        host.setVendor(get_device_description(d.vendor_id)+(enabled("output:numeric") ? " [" + tohex(d.vendor_id) + "]" : ""));
-        host.setProduct(get_device_description(d.vendor_id, d.device_id)+(enabled("output:numeric") ? " [" + tohex(d.vendor_id) + ":" + tohex(d.device_id) + "]" : ""));
+        host.setVendor(get_device_description(d.vendor_id)+(enabled(OPT_OUTPUT_NUMERIC) ? " [" + tohex(d.vendor_id) + "]" : ""));
+        host.setProduct(get_device_description(d.vendor_id, d.device_id)+(enabled(OPT_OUTPUT_NUMERIC) ? " [" + tohex(d.vendor_id) + ":" + tohex(d.device_id) + "]" : ""));
         host.setHandle(pci_bushandle(d.bus, d.domain));
         host.setVersion(revision);
         addHints(host, d.vendor_id, d.device_id, subsys_v, subsys_d, dclass);
@@ -862,9 +877,9 @@ static hwNode *scan_pci_dev(struct pci_dev &d, hwNode & n)
             {
                 device->addCapability(moredescription);
             }
-            device->setVendor(get_device_description(d.vendor_id)+(enabled("output:numeric") ? " [" + tohex(d.vendor_id) + "]" : ""));
+            device->setVendor(get_device_description(d.vendor_id)+(enabled(OPT_OUTPUT_NUMERIC) ? " [" + tohex(d.vendor_id) + "]" : ""));
             device->setVersion(revision);
-            device->setProduct(get_device_description(d.vendor_id, d.device_id)+(enabled("output:numeric") ? " [" + tohex(d.vendor_id) + ":" + tohex(d.device_id) + "]" : ""));
+            device->setProduct(get_device_description(d.vendor_id, d.device_id)+(enabled(OPT_OUTPUT_NUMERIC) ? " [" + tohex(d.vendor_id) + ":" + tohex(d.device_id) + "]" : ""));
 
             if(cmd & PCI_COMMAND_MASTER)
                 device->addCapability("bus master", "bus mastering");
@@ -915,8 +930,8 @@ bool scan_pci_legacy(hwNode & n)
         core = n.getChild("core");
     }
 
-    if(!pcidb_loaded)
-        pcidb_loaded = load_pcidb();
+    if(!pcidb().loaded)
+        pcidb().loaded = load_pcidb();
 
     f = fopen(PROC_BUS_PCI "/devices", "r");
     if(f)
@@ -1002,7 +1017,7 @@ bool scan_pci(hwNode & n)
         core = n.getChild("core");
     }
 
-    pcidb_loaded = load_pcidb();
+    pcidb().loaded = load_pcidb();
 
     if(!pushd(SYS_BUS_PCI"/devices"))
         return false;
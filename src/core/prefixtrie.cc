@@ -0,0 +1,93 @@
+/*
+ * prefixtrie.cc
+ *
+ * matching cost is bounded by the length of the string times the depth of
+ * the trie, instead of one regcomp()/regexec() per table entry
+ */
+
+#include "prefixtrie.h"
+#include "osutils.h"
+
+#include <ctype.h>
+#include <regex.h>
+
+prefix_trie::prefix_trie(const char **t, bool a) : table(t), anchored(a), nodes(2)
+{
+    for(int i = 0; table[2 * i]; i++)
+        if(!compile(table[2 * i], i))
+            fallback.push_back(i);
+}
+
+bool prefix_trie::compile(const string & pattern, int index)
+{
+    string literal = pattern;
+    unsigned int n = anchored ? 0 : 1;
+    bool more = false;
+
+    if(literal[0] == '^')
+    {
+        literal.erase(0, 1);
+        n = 0;
+    }
+    if((literal.length() >= 2) && (literal.compare(literal.length() - 2, 2, ".+") == 0))
+    {
+        literal.erase(literal.length() - 2);
+        more = true;
+    }
+    if((literal == "") || (literal.find_first_of("^$*+?()[]{}|\\") != string::npos))
+        return false;
+
+    for(size_t i = 0; i < literal.length(); i++)
+    {
+        char c = tolower((unsigned char) literal[i]);
+        size_t edge = nodes[n].labels.find(c);
+
+        if(edge == string::npos)
+        {
+            nodes[n].labels += c;
+            nodes[n].next.push_back(nodes.size());
+            nodes.push_back(node());
+            n = nodes.size() - 1;
+        }
+        else
+            n = nodes[n].next[edge];
+    }
+    nodes[n].ends.push_back(index);
+    nodes[n].more.push_back(more);
+
+    return true;
+}
+
+void prefix_trie::walk(unsigned int n, const string & s, size_t pos, int & best, bool last) const
+{
+    const node & current = nodes[n];
+
+    for(unsigned int i = 0; i < current.ends.size(); i++)
+        if(!current.more[i] || (pos < s.length()))
+            if((best < 0) || (last ? current.ends[i] > best : current.ends[i] < best))
+                best = current.ends[i];
+
+    if(pos >= s.length())
+        return;
+
+    for(unsigned int i = 0; i < current.labels.length(); i++)
+        if((current.labels[i] == '.') || (current.labels[i] == tolower((unsigned char) s[pos])))
+            walk(current.next[i], s, pos + 1, best, last);
+}
+
+int prefix_trie::match(const string & s, bool last) const
+{
+    int best = -1;
+
+    walk(0, s, 0, best, last);
+    if(nodes[1].labels != "")
+        for(size_t pos = 0; pos < s.length(); pos++)
+            walk(1, s, pos, best, last);
+
+    for(unsigned int i = 0; i < fallback.size(); i++)
+        if((best < 0) || (last ? fallback[i] > best : fallback[i] < best))
+            if(matches(s, (anchored ? "^" : "") + string(table[2 * fallback[i]]), REG_ICASE))
+                best = fallback[i];
+
+    return best;
+}
@@ -0,0 +1,41 @@
+#ifndef _PREFIXTRIE_H_
+#define _PREFIXTRIE_H_
+
+#include <string>
+#include <vector>
+
+using namespace std;
+
+/*
+ * the vendor tables ({pattern, value, ..., NULL, NULL}) compiled once into a
+ * case-insensitive trie. Patterns are the regular expression subset the
+ * tables use: an optional leading '^', literal characters or '.', and an
+ * optional trailing ".+"; anything else falls back to matches().
+ */
+class prefix_trie
+{
+  public:
+    // anchored: every pattern is matched at the start, as if it began with '^'
+    prefix_trie(const char **table, bool anchored = false);
+
+    // index of the first (or last) matching pattern in the table, -1 if none
+    int match(const string & s, bool last = false) const;
+
+  private:
+    struct node
+    {
+      string labels;                              // '.' matches any character
+      vector < unsigned int > next;
+      vector < int > ends;                        // pattern indexes
+      vector < bool > more;                       // pattern needs another character
+    };
+
+    bool compile(const string & pattern, int index);
+    void walk(unsigned int n, const string & s, size_t pos, int & best, bool last) const;
+
+    const char **table;
+    bool anchored;
+    vector < node > nodes;                        // 0: anchored root, 1: floating root
+    vector < int > fallback;
+};
+#endif
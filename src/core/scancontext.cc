@@ -0,0 +1,84 @@
+/*
+ * scancontext.cc
+ *
+ *
+ */
+
+#include "scancontext.h"
+
+#include <sched.h>
+#include <pthread.h>
+
+static __thread ScanContext *current = NULL;
+static __thread const options *current_settings = NULL;
+
+ScanContext::ScanContext() : currentcpu(0), pci(NULL), scsi(NULL), sysfs(NULL)
+{
+}
+
+ScanContext::~ScanContext()
+{
+    delete pci;
+    delete scsi;
+    delete sysfs;
+}
+
+scoped_context::scoped_context(ScanContext & c, const options * settings) :
+    previous(current), previous_settings(current_settings)
+{
+    current = &c;
+    current_settings = settings;
+}
+
+scoped_context::~scoped_context()
+{
+    current = previous;
+    current_settings = previous_settings;
+}
+
+ScanContext & default_context()
+{
+    static ScanContext context;
+
+    return context;
+}
+
+ScanContext & scan_context()
+{
+    return current ? *current : default_context();
+}
+
+const options & scan_settings()
+{
+    return current_settings ? *current_settings : scan_context().settings;
+}
+
+struct isolated_call
+{
+    void (*scan)(void *);
+    void *arg;
+};
+
+static void *isolated_main(void *arg)
+{
+    isolated_call *call = (isolated_call *) arg;
+
+    unshare(CLONE_FS);
+    call->scan(call->arg);
+
+    return NULL;
+}
+
+void run_isolated(void (*scan)(void *), void *arg)
+{
+    isolated_call call;
+    pthread_t thread;
+
+    call.scan = scan;
+    call.arg = arg;
+    // without a thread, the scan shares the working directory as it used to
+    if(pthread_create(&thread, NULL, isolated_main, &call) != 0)
+        scan(arg);
+    else
+        pthread_join(thread, NULL);
+}
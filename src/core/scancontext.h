@@ -0,0 +1,74 @@
+#ifndef _SCANCONTEXT_H_
+#define _SCANCONTEXT_H_
+
+#include "options.h"
+
+#include <map>
+#include <stack>
+#include <string>
+#include <sys/types.h>
+
+// state private to one module (pci.cc, scsi.cc...), owned by the context
+struct scan_state
+{
+    virtual ~scan_state() {}
+};
+
+/*
+ * everything a scan reads, caches or changes, so that several scans can
+ * run in parallel threads of the same process: a thread uses the context
+ * installed with scoped_context, threads without one share a process-wide
+ * context
+ */
+class ScanContext
+{
+  public:
+    ScanContext();
+    ~ScanContext();
+
+    options settings;
+
+    std::stack < std::string > dirs;              // pushd()/popd()
+    int currentcpu;                               // DMI processors
+    std::map < u_int16_t, std::string > usbvendors;
+    std::map < u_int32_t, std::string > usbproducts;
+    std::map < std::string, std::string > sg_map; // SCSI generic devices
+    std::string sysfs_root;                       // empty: the mounted sysfs
+
+    // created by each module on first use, deleted with the context
+    scan_state *pci;
+    scan_state *scsi;
+    scan_state *sysfs;
+
+  private:
+    ScanContext(const ScanContext &);
+    ScanContext & operator =(const ScanContext &);
+};
+
+/*
+ * makes c the context of the calling thread for as long as it is in scope,
+ * scanning with settings instead of c.settings if given
+ */
+class scoped_context
+{
+  public:
+    scoped_context(ScanContext & c, const options * settings = NULL);
+    ~scoped_context();
+
+  private:
+    ScanContext *previous;
+    const options *previous_settings;
+};
+
+ScanContext & scan_context();
+ScanContext & default_context();
+// the settings of the scan running in the calling thread
+const options & scan_settings();
+
+/*
+ * runs scan(arg) in a thread started for it and waits for it: pushd() and
+ * popd() change the working directory of that thread only, never the
+ * caller's or the process'
+ */
+void run_isolated(void (*scan)(void *), void *arg);
+#endif
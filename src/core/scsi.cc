@@ -3,6 +3,7 @@
 #include "disk.h"
 #include "osutils.h"
 #include "heuristics.h"
+#include "scancontext.h"
 #include "sysfs.h"
 #include <glob.h>
 #include <sys/types.h>
@@ -14,6 +15,9 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <pthread.h>
 #include <scsi/sg.h>
 #include <scsi/scsi.h>
 #ifndef MKDEV
@@ -25,10 +29,14 @@
 
 #include <string>
 #include <map>
+#include <algorithm>
 
 
 #define SG_X "/dev/sg%d"
 #define SG_MAJOR 21
+#define SG_WORKERS 16
+#define SYSFS_SCSI "/sys/class/scsi_device"
+#define SYSFS_SCSI_HOST "/sys/class/scsi_host"
 
 #ifndef SCSI_IOCTL_GET_PCI
 #define SCSI_IOCTL_GET_PCI 0x5387
@@ -48,6 +56,8 @@
 #define SENSE_PAGE_SERIAL 0x80
 
 #define MX_ALLOC_LEN 255
+#define INQ_TIMEOUT 5000                          /* 5 seconds */
+#define SENSE_TIMEOUT 10000                       /* 10 seconds */
 #define EBUFF_SZ 256
 
 /* Some of the following error/status codes are exchanged between the
@@ -195,7 +205,6 @@ static const char *devices[] = {
     NULL
 };
 
-static map < string, string > sg_map;
 
 static string scsi_handle(unsigned int host,
         int channel = -1,
@@ -338,7 +347,7 @@ static bool do_modesense(int sg_fd,
     io_hdr.dxferp = resp;
     io_hdr.cmdp = senseCmdBlk;
     io_hdr.sbp = sense_b;
-    io_hdr.timeout = 20000; /* 20 seconds */
+    io_hdr.timeout = SENSE_TIMEOUT;
 
     if(ioctl(sg_fd, SG_IO, &io_hdr) < 0)
         return false;
@@ -387,7 +396,7 @@ static bool do_inq(int sg_fd,
     io_hdr.dxferp = resp;
     io_hdr.cmdp = inqCmdBlk;
     io_hdr.sbp = sense_b;
-    io_hdr.timeout = 20000; /* 20 seconds */
+    io_hdr.timeout = INQ_TIMEOUT;
 
     if(ioctl(sg_fd, SG_IO, &io_hdr) < 0)
         return false;
@@ -532,6 +541,7 @@ static bool do_inquiry(int sg_fd,
 
 static void scan_devices()
 {
+    map < string, string > & sg_map = scan_context().sg_map;
     int fd = -1;
     int i = 0;
     size_t j = 0;
@@ -579,8 +589,119 @@ static void scan_devices()
     }
 }
 
+/*
+ * SCSI topology from sysfs: every /sys/class/scsi_device/H:C:T:L entry
+ * gives its address, type, identity strings and the names of its block,
+ * tape and sg nodes without opening any of them.
+ */
+struct scsi_lun
+{
+    int host, channel, target, lun;
+    int type;
+    string vendor, model, rev;
+    string queue_depth;
+    string sg;              // "sg0", empty when the sg driver is not loaded
+    vector < string > nodes; // kernel names: "sda", "st0", "nst0"...
+};
+
+struct scsi_state : public scan_state
+{
+    vector < scsi_lun > luns;
+};
+
+static vector < scsi_lun > & sysfs_luns()
+{
+    ScanContext & context = scan_context();
+
+    if(!context.scsi)
+        context.scsi = new scsi_state;
+    return static_cast < scsi_state * >(context.scsi)->luns;
+}
+
+static bool lun_order(const scsi_lun & a, const scsi_lun & b)
+{
+    if(a.host != b.host) return a.host < b.host;
+    if(a.channel != b.channel) return a.channel < b.channel;
+    if(a.target != b.target) return a.target < b.target;
+    return a.lun < b.lun;
+}
+
+// class links: "block/sda" on current kernels, "block:sda" on older ones
+static vector < string > class_links(const string & device, const string & devclass)
+{
+    vector < string > result = list_dir(device + "/" + devclass);
+    vector < string > all;
+
+    if(result.size() > 0)
+        return result;
+
+    all = list_dir(device);
+    for(unsigned int i = 0; i < all.size(); i++)
+        if(all[i].compare(0, devclass.length() + 1, devclass + ":") == 0)
+            result.push_back(all[i].substr(devclass.length() + 1));
+
+    return result;
+}
+
+static bool scan_sysfs_luns()
+{
+    vector < string > entries = list_dir(SYSFS_SCSI);
+    vector < scsi_lun > & luns = sysfs_luns();
+    map < string, string > & sg_map = scan_context().sg_map;
+
+    luns.clear();
+    if(entries.size() == 0)
+        return false;
+
+    for(unsigned int i = 0; i < entries.size(); i++)
+    {
+        string device = string(SYSFS_SCSI) + "/" + entries[i] + "/device";
+        vector < string > links;
+        scsi_lun l;
+
+        if(sscanf(entries[i].c_str(), "%d:%d:%d:%d", &l.host, &l.channel, &l.target, &l.lun) != 4)
+            continue;
+
+        l.type = atoi(get_string(device + "/type", "-1").c_str());
+        l.vendor = hw::strip(get_string(device + "/vendor"));
+        l.model = hw::strip(get_string(device + "/model"));
+        l.rev = hw::strip(get_string(device + "/rev"));
+        l.queue_depth = get_string(device + "/queue_depth");
+
+        links = class_links(device, "scsi_generic");
+        if(links.size() > 0)
+            l.sg = links[0];
+
+        links = class_links(device, "block");
+        l.nodes.insert(l.nodes.end(), links.begin(), links.end());
+        links = class_links(device, "scsi_tape");
+        l.nodes.insert(l.nodes.end(), links.begin(), links.end());
+
+        for(unsigned int j = 0; j < l.nodes.size(); j++)
+            sg_map["/dev/" + l.nodes[j]] = scsi_handle(l.host, l.channel, l.target, l.lun);
+
+        luns.push_back(l);
+    }
+    sort(luns.begin(), luns.end(), lun_order);
+
+    return true;
+}
+
+static const scsi_lun *find_lun(const My_sg_scsi_id & id)
+{
+    vector < scsi_lun > & luns = sysfs_luns();
+
+    for(unsigned int i = 0; i < luns.size(); i++)
+        if(luns[i].host == id.host_no && luns[i].channel == id.channel
+                && luns[i].target == id.scsi_id && luns[i].lun == id.lun)
+            return &luns[i];
+
+    return NULL;
+}
+
 static void find_logicalname(hwNode & n)
 {
+    map < string, string > & sg_map = scan_context().sg_map;
     map < string, string >::iterator i = sg_map.begin();
 
     for(i = sg_map.begin(); i != sg_map.end(); i++)
@@ -633,16 +754,52 @@ static bool atapi(const hwNode & n)
     return n.isCapable("atapi") && (n.countChildren() == 0);
 }
 
-static bool scan_sg(int sg, hwNode & n)
+/*
+ * SG probing runs from a bounded pool of worker threads, so that one slow
+ * or spun-down device does not hold up the others. With sysfs, every LUN
+ * is described from its scsi_lun and the worker only opens its sg node,
+ * if it has one, for the INQUIRY/MODE SENSE data: a node that can't be
+ * opened (no root, no descriptors left) doesn't lose the LUN. Without
+ * sysfs, the workers take the next /dev/sgN index and identify the node
+ * with SG_GET_SCSI_ID. Either way a worker holds one open node at most,
+ * and the results are merged into the tree in a fixed order, exactly as
+ * a sequential scan would.
+ */
+struct sg_probe
 {
-    char buffer[20];
-    int fd = -1;
+    long index;                                   // of /dev/sgN, -1 without sg node
+    int fd;
+    bool identified;
     My_sg_scsi_id m_id;
+    int emulated;
     char slot_name[64]; // should be 16 but some 2.6 kernels require 32 bytes
-    string host = "";
-    string businfo = "";
-    hwNode *parent = NULL;
-    int emulated = 0;
+    const scsi_lun *lun;
+    hwNode device;
+
+    sg_probe() : index(-1), fd(-1), identified(false), emulated(0), lun(NULL), device("generic")
+    {
+        memset(&m_id, 0, sizeof(m_id));
+        memset(slot_name, 0, sizeof(slot_name));
+    }
+};
+
+struct sg_pool
+{
+    vector < sg_probe > *probes;                  // the LUNs known from sysfs
+    unsigned long next;
+    long next_sg;
+    long last_sg;                                 // first index without node, LONG_MAX until found
+    vector < sg_probe > found;                    // the sg nodes without sysfs, in any order
+    pthread_mutex_t lock;                         // protects found
+    ScanContext *context;                         // the scan the workers belong to
+    const options *settings;                      // and the settings it runs with
+};
+
+static int open_sg(int sg)
+{
+    char buffer[20];
+    int fd = -1;
+    int error = 0;
     bool ghostdeventry = false;
 
     snprintf(buffer, sizeof(buffer), SG_X, sg);
@@ -651,25 +808,18 @@ static bool scan_sg(int sg, hwNode & n)
 
     if(ghostdeventry) mknod(buffer, (S_IFCHR | S_IREAD), MKDEV(SG_MAJOR, sg));
     fd = open(buffer, OPEN_FLAG | O_NONBLOCK);
+    error = errno;
     if(ghostdeventry) unlink(buffer);
-    if(fd < 0)
-        return false;
+    errno = error;
 
-    memset(&m_id, 0, sizeof(m_id));
-    if(ioctl(fd, SG_GET_SCSI_ID, &m_id) < 0)
-    {
-        close(fd);
-        return true; // we failed to get info but still hope we can continue
-    }
-
-    ioctl(fd, SG_EMULATED_HOST, &emulated);
-
-    host = host_logicalname(m_id.host_no);
-    businfo = scsi_businfo(m_id.host_no);
+    return fd;
+}
 
-    hwNode device = hwNode("generic");
+static void make_device(sg_probe & p)
+{
+    hwNode & device = p.device;
 
-    switch(m_id.scsi_type)
+    switch(p.m_id.scsi_type)
     {
         case 0:
         case 14:
@@ -699,14 +849,32 @@ static bool scan_sg(int sg, hwNode & n)
             break;
     }
 
-    device.setDescription(string(scsi_type(m_id.scsi_type)));
-    device.setHandle(scsi_handle(m_id.host_no,
-            m_id.channel, m_id.scsi_id, m_id.lun));
-    device.setBusInfo(scsi_businfo(m_id.host_no,
-            m_id.channel, m_id.scsi_id, m_id.lun));
-    device.setPhysId(m_id.channel, m_id.scsi_id, m_id.lun);
+    device.setDescription(string(scsi_type(p.m_id.scsi_type)));
+    device.setHandle(scsi_handle(p.m_id.host_no,
+            p.m_id.channel, p.m_id.scsi_id, p.m_id.lun));
+    device.setBusInfo(scsi_businfo(p.m_id.host_no,
+            p.m_id.channel, p.m_id.scsi_id, p.m_id.lun));
+    device.setPhysId(p.m_id.channel, p.m_id.scsi_id, p.m_id.lun);
     find_logicalname(device);
-    do_inquiry(fd, device);
+}
+
+static void finish_device(sg_probe & p)
+{
+    hwNode & device = p.device;
+
+    if(p.lun)
+    {
+        // INQUIRY may have failed or timed out, sysfs has the same strings
+        if(device.getVendor() == "")
+            device.setVendor(p.lun->vendor);
+        if(device.getProduct() == "")
+            device.setProduct(p.lun->model);
+        if(device.getVersion() == "")
+            device.setVersion(p.lun->rev);
+        if(p.lun->queue_depth != "")
+            device.setConfig("queue_depth", p.lun->queue_depth);
+    }
+
     if(device.getVendor() == "ATA")
     {
         device.setDescription("ATA " + device.getDescription());
@@ -717,23 +885,113 @@ static bool scan_sg(int sg, hwNode & n)
         device.setDescription("SCSI " + device.getDescription());
         device.addHint("bus.icon", string("scsi"));
     }
-    if((m_id.scsi_type == 4) || (m_id.scsi_type == 5))
+    if((p.m_id.scsi_type == 4) || (p.m_id.scsi_type == 5))
         scan_cdrom(device);
-    if((m_id.scsi_type == 0) || (m_id.scsi_type == 7) || (m_id.scsi_type == 14))
+    if((p.m_id.scsi_type == 0) || (p.m_id.scsi_type == 7) || (p.m_id.scsi_type == 14))
         scan_disk(device);
+}
+
+// must not touch the tree, runs concurrently with the other probes
+static void probe_sg(sg_probe & p)
+{
+    if(!p.lun)
+    {
+        if(ioctl(p.fd, SG_GET_SCSI_ID, &p.m_id) < 0)
+            return; // we failed to get info but still hope we can continue
+        p.lun = find_lun(p.m_id);
+    }
+    p.identified = true;
 
-    memset(slot_name, 0, sizeof(slot_name));
-    //这个地方在3.4以上的内核中有问题，slot_name会变成ata1，而不是0000:00:1f.2之类的
-    if(ioctl(fd, SCSI_IOCTL_GET_PCI, slot_name) >= 0)
+    make_device(p);
+    if(p.fd >= 0)
     {
-        parent = n.findChildByBusInfo(guessBusInfo(hw::strip(slot_name)));
+        ioctl(p.fd, SG_EMULATED_HOST, &p.emulated);
+        do_inquiry(p.fd, p.device);
+
+        //这个地方在3.4以上的内核中有问题，slot_name会变成ata1，而不是0000:00:1f.2之类的
+        if(ioctl(p.fd, SCSI_IOCTL_GET_PCI, p.slot_name) < 0)
+            memset(p.slot_name, 0, sizeof(p.slot_name));
+    }
+    finish_device(p);
+}
+
+// the enumeration ends at the first missing node, not at a node that can't be opened
+static void end_of_sgs(sg_pool *pool, long sg)
+{
+    long last = pool->last_sg;
+
+    while((sg < last) && !__sync_bool_compare_and_swap(&pool->last_sg, last, sg))
+        last = pool->last_sg;
+}
+
+static void *sg_worker(void *arg)
+{
+    sg_pool *pool = (sg_pool *) arg;
+    scoped_context scope(*pool->context, pool->settings);
+    unsigned long i;
+    long sg;
+
+    while((sg = __sync_fetch_and_add(&pool->next_sg, 1)) < pool->last_sg)
+    {
+        sg_probe p;
+
+        p.index = sg;
+        p.fd = open_sg(sg);
+        if(p.fd < 0)
+        {
+            if((errno == ENOENT) || (errno == ENXIO))
+                end_of_sgs(pool, sg);
+            continue;
+        }
+        probe_sg(p);
+        close(p.fd);
+        p.fd = -1;
+
+        pthread_mutex_lock(&pool->lock);
+        pool->found.push_back(p);
+        pthread_mutex_unlock(&pool->lock);
+    }
+
+    while((i = __sync_fetch_and_add(&pool->next, 1)) < pool->probes->size())
+    {
+        sg_probe & p = (*pool->probes)[i];
+
+        if(p.lun->sg.compare(0, 2, "sg") == 0)
+            p.fd = open_sg(atoi(p.lun->sg.c_str() + 2));
+        probe_sg(p);
+        if(p.fd >= 0)
+            close(p.fd);
+        p.fd = -1;
+    }
+
+    return NULL;
+}
+
+static bool sg_order(const sg_probe & a, const sg_probe & b)
+{
+    return a.index < b.index;
+}
+
+static void attach_sg(sg_probe & p, hwNode & n)
+{
+    string host = "";
+    hwNode *parent = NULL;
+
+    if(!p.identified)
+        return;
+
+    host = host_logicalname(p.m_id.host_no);
+
+    if(p.slot_name[0])
+    {
+        parent = n.findChildByBusInfo(guessBusInfo(hw::strip(p.slot_name)));
     }
 
     if(!parent)
         parent = n.findChildByLogicalName(host);
 
     // IDE-SCSI pseudo host controller
-    if(emulated && device.getConfig("driver") == "ide-scsi")
+    if(p.emulated && p.device.getConfig("driver") == "ide-scsi")
     {
         hwNode *ideatapi = n.findChild(atapi);
 
@@ -753,23 +1011,124 @@ static bool scan_sg(int sg, hwNode & n)
         parent = n.addChild(hwNode("scsi", hw::storage));
 
     if(!parent)
-    {
-        close(fd);
-        return true;
-    }
+        return;
 
     if(parent->getBusInfo() == "")
-        parent->setBusInfo(guessBusInfo(hw::strip(slot_name)));
+        parent->setBusInfo(guessBusInfo(hw::strip(p.slot_name)));
     parent->setLogicalName(host);
     parent->claim();
 
-    if(emulated)
+    if(p.emulated)
     {
         parent->addCapability("emulated", "Emulated device");
     }
-    parent->addChild(device);
-    
-    close(fd);
+    parent->addChild(p.device);
+}
+
+static void scan_sgs(hwNode & n)
+{
+    vector < sg_probe > probes;
+    vector < scsi_lun > & luns = sysfs_luns();
+    vector < pthread_t > workers;
+    size_t count = luns.size() ? min(luns.size(), (size_t) SG_WORKERS) : SG_WORKERS;
+    sg_pool pool;
+
+    for(unsigned int i = 0; i < luns.size(); i++)
+    {
+        sg_probe p;
+
+        p.lun = &luns[i];
+        p.m_id.host_no = p.lun->host;
+        p.m_id.channel = p.lun->channel;
+        p.m_id.scsi_id = p.lun->target;
+        p.m_id.lun = p.lun->lun;
+        p.m_id.scsi_type = p.lun->type;
+        probes.push_back(p);
+    }
+
+    pool.probes = &probes;
+    pool.next = 0;
+    pool.next_sg = 0;
+    pool.last_sg = (luns.size() > 0) ? 0 : LONG_MAX; // /dev/sgN enumeration without sysfs only
+    pool.context = &scan_context();
+    pool.settings = &scan_settings();
+    pthread_mutex_init(&pool.lock, NULL);
+    for(size_t i = 1; i < count; i++)
+    {
+        pthread_t t;
+
+        if(pthread_create(&t, NULL, sg_worker, &pool) != 0)
+            break;
+        workers.push_back(t);
+    }
+    sg_worker(&pool);
+    for(size_t i = 0; i < workers.size(); i++)
+        pthread_join(workers[i], NULL);
+    pthread_mutex_destroy(&pool.lock);
+
+    // nodes opened past a missing one by another worker are dropped
+    sort(pool.found.begin(), pool.found.end(), sg_order);
+    for(size_t i = 0; i < pool.found.size() && pool.found[i].index < pool.last_sg; i++)
+        attach_sg(pool.found[i], n);
+    for(size_t i = 0; i < probes.size(); i++)
+        attach_sg(probes[i], n);
+}
+
+static void claim_host(hwNode & node, int number, const string & driver)
+{
+    hwNode *controller =
+            node.findChildByLogicalName(host_logicalname(number));
+
+    if(!controller)
+    {
+        string parentbusinfo = sysfs_getbusinfo(sysfs::entry::byClass("scsi_host", host_kname(number)));
+
+        controller = node.findChildByBusInfo(parentbusinfo);
+    }
+
+    if(!controller)
+    {
+        controller = node.addChild(hwNode("scsi", hw::storage));
+        if(controller)
+        {
+            controller->setLogicalName(host_logicalname(number));
+            controller->setBusInfo(scsi_businfo(number));
+        }
+    }
+
+    if(controller)
+    {
+        controller->setLogicalName(host_logicalname(number));
+        if(driver != "")
+            controller->setConfig(string("driver"), driver);
+        controller->setHandle(scsi_handle(number));
+        controller->addCapability("scsi-host", "SCSI host adapter");
+        controller->claim();
+    }
+}
+
+static bool scan_sysfs_hosts(hwNode & node)
+{
+    vector < string > hosts = list_dir(SYSFS_SCSI_HOST);
+
+    if(hosts.size() == 0)
+        return false;
+
+    for(unsigned int i = 0; i < hosts.size(); i++)
+    {
+        int number = -1;
+        hwNode *host = NULL;
+
+        if(sscanf(hosts[i].c_str(), "host%d", &number) != 1)
+            continue;
+
+        claim_host(node, number, get_string(string(SYSFS_SCSI_HOST) + "/" + hosts[i] + "/proc_name"));
+
+        host = node.findChildByLogicalName(host_logicalname(number));
+        if(host && (host->getProduct() == "") && (host->getDescription() == ""))
+            host->setDescription("SCSI storage controller");
+    }
+
     return true;
 }
 
@@ -806,37 +1165,7 @@ static bool scan_hosts(hwNode & node)
                 number = strtol(filelist[j]->d_name, &end, 0);
 
                 if((number >= 0) && (end != filelist[j]->d_name))
-                {
-                    hwNode *controller =
-                            node.findChildByLogicalName(host_logicalname(number));
-
-                    if(!controller)
-                    {
-                        string parentbusinfo = sysfs_getbusinfo(sysfs::entry::byClass("scsi_host", host_kname(number)));
-
-                        controller = node.findChildByBusInfo(parentbusinfo);
-                    }
-
-                    if(!controller)
-                    {
-                        controller = node.addChild(hwNode("scsi", hw::storage));
-                        if(controller)
-                        {
-                            controller->setLogicalName(host_logicalname(number));
-                            controller->setBusInfo(scsi_businfo(number));
-                        }
-                    }
-
-                    if(controller)
-                    {
-                        controller->setLogicalName(host_logicalname(number));
-                        controller->setConfig(string("driver"),
-                                string(namelist[i]->d_name));
-                        controller->setHandle(scsi_handle(number));
-                        controller->addCapability("scsi-host", "SCSI host adapter");
-                        controller->claim();
-                    }
-                }
+                    claim_host(node, number, namelist[i]->d_name);
                 free(filelist[j]);
             }
             free(filelist);
@@ -865,14 +1194,12 @@ static bool scan_hosts(hwNode & node)
 
 bool scan_scsi(hwNode & n)
 {
-    int i = 0;
-
-    scan_devices();
-
-    while(scan_sg(i, n))
-        i++;
+    if(!scan_sysfs_luns())
+        scan_devices();
+    scan_sgs(n);
 
-    scan_hosts(n);
+    if(!scan_sysfs_hosts(n))
+        scan_hosts(n);
 
     return false;
 }
@@ -6,44 +6,339 @@
 #include <errno.h>
 #include <stdlib.h>
 #include <cstring>
+#include <pthread.h>
+#include <time.h>
 #include "sensors.h"
 
-string sensors()
+#define RING_SIZE 1024
+
+struct channel
 {
-    FILE *sens_conf_file = NULL;
+    const sensors_chip_name *chip;
+    int number;     // input subfeature
+    string name;
+};
 
-    int chipnum = 0, err;
-    double curvalue;
-    char* degree;
-    char buffer[100] = {}; //init zero
-    string result;
+/*
+ * Single writer, many readers. Every slot carries a sequence number
+ * that is odd while the sampler rewrites it; a reader that sees it
+ * change under its feet drops that sample.
+ */
+struct ring
+{
+    unsigned long head;     // samples written so far
+    unsigned seq[RING_SIZE];
+    double time[RING_SIZE];
+    double *values;         // RING_SIZE x channels
+};
+
+static pthread_mutex_t engine_lock = PTHREAD_MUTEX_INITIALIZER;
+static int init_error = -1;     // -1 until sensors_init has been called
+static bool ready = false;      // channels enumerated
+static vector < channel > channels;
+static struct ring samples;
+static pthread_t sampler;
+static bool running = false;
+static long interval = 0;       // nanoseconds between samples
 
-    const sensors_chip_name *name = NULL;
-    err = sensors_init(sens_conf_file);
-    if(err)
+static double now()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static const char *type_name(sensors_feature_type type)
+{
+    switch(type)
     {
-        snprintf(buffer, sizeof(buffer), "sensors_init %s", sensors_strerror(err));
-        result = string(buffer);
-        return result;
+        case SENSORS_FEATURE_IN:
+            return "voltage";
+        case SENSORS_FEATURE_FAN:
+            return "fan";
+        case SENSORS_FEATURE_TEMP:
+            return "temp";
+        case SENSORS_FEATURE_POWER:
+            return "power";
+        case SENSORS_FEATURE_CURR:
+            return "current";
+        default:
+            return NULL;
     }
+}
 
-    degree = degree_sign();
+static const sensors_subfeature *input_of(const sensors_chip_name *chip, const sensors_feature *feature)
+{
+    const sensors_subfeature *sub = NULL;
 
-    while((name = sensors_get_detected_chips(NULL, &chipnum)) != NULL)
+    switch(feature->type)
     {
-        if(name->bus.type == SENSORS_BUS_TYPE_ISA && strcmp(name->prefix, "coretemp") == 0)
+        case SENSORS_FEATURE_IN:
+            return sensors_get_subfeature(chip, feature, SENSORS_SUBFEATURE_IN_INPUT);
+        case SENSORS_FEATURE_FAN:
+            return sensors_get_subfeature(chip, feature, SENSORS_SUBFEATURE_FAN_INPUT);
+        case SENSORS_FEATURE_TEMP:
+            return sensors_get_subfeature(chip, feature, SENSORS_SUBFEATURE_TEMP_INPUT);
+        case SENSORS_FEATURE_POWER:
+            sub = sensors_get_subfeature(chip, feature, SENSORS_SUBFEATURE_POWER_INPUT);
+            if(!sub)
+                sub = sensors_get_subfeature(chip, feature, SENSORS_SUBFEATURE_POWER_AVERAGE);
+            return sub;
+        case SENSORS_FEATURE_CURR:
+            return sensors_get_subfeature(chip, feature, SENSORS_SUBFEATURE_CURR_INPUT);
+        default:
+            return NULL;
+    }
+}
+
+// call with engine_lock held
+static bool engine_init()
+{
+    const sensors_chip_name *chip = NULL;
+    int chipnum = 0;
+
+    if(init_error >= 0)
+        return init_error == 0;
+
+    init_error = sensors_init(NULL);
+    if(init_error)
+        return false;
+
+    while((chip = sensors_get_detected_chips(NULL, &chipnum)) != NULL)
+    {
+        const sensors_feature *feature = NULL;
+        int featurenum = 0;
+        char chipname[64];
+
+        if(sensors_snprintf_chip_name(chipname, sizeof(chipname), chip) < 0)
+            continue;
+
+        while((feature = sensors_get_features(chip, &featurenum)) != NULL)
         {
-            sensors_get_value(name, 0, &curvalue);
-            snprintf(buffer, sizeof(buffer), "%.f%sC", curvalue, degree);
+            const sensors_subfeature *sub = input_of(chip, feature);
+            const char *type = type_name(feature->type);
+            char *label = NULL;
+            channel c;
+
+            if(!sub || !type)
+                continue;
+
+            label = sensors_get_label(chip, feature);
+            c.chip = chip;
+            c.number = sub->number;
+            c.name = string(chipname) + "/" + (label ? label : feature->name) + " (" + type + ")";
+            free(label);
+
+            channels.push_back(c);
         }
     }
 
-    sensors_cleanup();
+    samples.values = (double *) calloc(RING_SIZE * (channels.size() ? channels.size() : 1), sizeof(double));
+    __atomic_store_n(&ready, true, __ATOMIC_RELEASE);
+
+    return true;
+}
+
+static void *sample_loop(void *)
+{
+    size_t n = channels.size();
+
+    while(__atomic_load_n(&running, __ATOMIC_ACQUIRE))
+    {
+        struct timespec delay;
+        unsigned long head = samples.head;
+        unsigned slot = head % RING_SIZE;
+        long ns = __atomic_load_n(&interval, __ATOMIC_RELAXED);
+
+        __atomic_store_n(&samples.seq[slot], samples.seq[slot] + 1, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_RELEASE);
+
+        samples.time[slot] = now();
+        for(size_t i = 0; i < n; i++)
+        {
+            double value = 0;
+
+            if(sensors_get_value(channels[i].chip, channels[i].number, &value) != 0)
+                value = 0;
+            samples.values[slot * n + i] = value;
+        }
+
+        __atomic_store_n(&samples.seq[slot], samples.seq[slot] + 1, __ATOMIC_RELEASE);
+        __atomic_store_n(&samples.head, head + 1, __ATOMIC_RELEASE);
+
+        delay.tv_sec = ns / 1000000000L;
+        delay.tv_nsec = ns % 1000000000L;
+        nanosleep(&delay, NULL);
+    }
+
+    return NULL;
+}
+
+bool sensors_start(double rate)
+{
+    bool result = false;
+
+    if(rate <= 0)
+        return false;
+
+    pthread_mutex_lock(&engine_lock);
+    if(engine_init())
+    {
+        __atomic_store_n(&interval, (long) (1e9 / rate), __ATOMIC_RELAXED);
+        if(running)
+            result = true;
+        else
+        {
+            running = true;
+            result = (pthread_create(&sampler, NULL, sample_loop, NULL) == 0);
+            running = result;
+        }
+    }
+    pthread_mutex_unlock(&engine_lock);
+
+    return result;
+}
+
+void sensors_stop()
+{
+    pthread_mutex_lock(&engine_lock);
+    if(running)
+    {
+        __atomic_store_n(&running, false, __ATOMIC_RELEASE);
+        pthread_join(sampler, NULL);
+    }
+    pthread_mutex_unlock(&engine_lock);
+}
+
+vector<string> sensors_channels()
+{
+    vector < string > result;
+
+    pthread_mutex_lock(&engine_lock);
+    if(engine_init())
+        for(size_t i = 0; i < channels.size(); i++)
+            result.push_back(channels[i].name);
+    pthread_mutex_unlock(&engine_lock);
+
+    return result;
+}
+
+double sensors_read(int channel)
+{
+    double value = 0;
+
+    pthread_mutex_lock(&engine_lock);
+    if(!engine_init() || channel < 0 || (size_t) channel >= channels.size()
+            || sensors_get_value(channels[channel].chip, channels[channel].number, &value) != 0)
+        value = 0;
+    pthread_mutex_unlock(&engine_lock);
+
+    return value;
+}
+
+sensor_stats sensors_window(int channel, double seconds)
+{
+    sensor_stats result = {0, 0, 0, 0};
+    unsigned long head, count;
+    double since = now() - seconds;
+    double sum = 0;
+    size_t n;
+
+    // channels are filled in once, before ready is set
+    if(!__atomic_load_n(&ready, __ATOMIC_ACQUIRE) || channel < 0 || (size_t) channel >= channels.size())
+        return result;
+    n = channels.size();
+
+    head = __atomic_load_n(&samples.head, __ATOMIC_ACQUIRE);
+    count = head < RING_SIZE ? head : RING_SIZE;
+    for(unsigned long k = 1; k <= count; k++)
+    {
+        unsigned slot = (head - k) % RING_SIZE;
+        unsigned seq = __atomic_load_n(&samples.seq[slot], __ATOMIC_ACQUIRE);
+        double time, value;
+
+        if(seq & 1)
+            continue;
+        time = samples.time[slot];
+        value = samples.values[slot * n + channel];
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if(__atomic_load_n(&samples.seq[slot], __ATOMIC_RELAXED) != seq)
+            continue;   // overwritten while we were reading it
+
+        if(time < since)
+            break;
+
+        if(result.samples == 0 || value < result.min)
+            result.min = value;
+        if(result.samples == 0 || value > result.max)
+            result.max = value;
+        sum += value;
+        result.samples++;
+    }
+
+    if(result.samples)
+        result.avg = sum / result.samples;
 
-    result = string(buffer);
     return result;
 }
 
+/*
+ * CPU package temperature: the hottest coretemp "Package"/first input
+ */
+double sensors_package()
+{
+    double temperature = 0;
+    bool found = false;
+
+    pthread_mutex_lock(&engine_lock);
+    if(engine_init())
+        for(size_t i = 0; i < channels.size(); i++)
+        {
+            const sensors_chip_name *name = channels[i].chip;
+            double curvalue;
+
+            if(i > 0 && channels[i - 1].chip == name)
+                continue;   // first temperature input of each chip only
+            if(name->bus.type == SENSORS_BUS_TYPE_ISA && strcmp(name->prefix, "coretemp") == 0
+                    && sensors_get_value(name, channels[i].number, &curvalue) == 0)
+            {
+                if(!found || curvalue > temperature)
+                    temperature = curvalue;
+                found = true;
+            }
+        }
+    pthread_mutex_unlock(&engine_lock);
+
+    return temperature;
+}
+
+string sensors()
+{
+    double temperature;
+    char* degree;
+    char buffer[100] = {}; //init zero
+
+    pthread_mutex_lock(&engine_lock);
+    if(!engine_init())
+    {
+        snprintf(buffer, sizeof(buffer), "sensors_init %s", sensors_strerror(init_error));
+        pthread_mutex_unlock(&engine_lock);
+        return string(buffer);
+    }
+    pthread_mutex_unlock(&engine_lock);
+
+    temperature = sensors_package();
+    if(temperature > 0)
+    {
+        degree = degree_sign();
+        snprintf(buffer, sizeof(buffer), "%.f%sC", temperature, degree);
+        free(degree);
+    }
+
+    return string(buffer);
+}
+
 static char *iconv_from_utf8_to_locale(char *string, const char* fallback_string)
 {
     const size_t buffer_inc = 80; // Increment buffer size in 80 bytes step
@@ -105,7 +400,7 @@ iconv_error:
 
 char *degree_sign()
 {
-    char str[] = {0xc2, 0xb0, 0x00};
+    char str[] = {(char) 0xc2, (char) 0xb0, 0x00};
 
     return iconv_from_utf8_to_locale(str, " \0");
 }
@@ -118,6 +413,7 @@ string record_sign()
 
     degree = degree_sign();
     snprintf(buffer, sizeof(buffer), "%sC", degree);
+    free(degree);
     result = string(buffer);
 
     return result;
@@ -2,10 +2,32 @@
 #define _SENSORS_H_
 
 #include <string>
+#include <vector>
 
 using namespace std;
 
+struct sensor_stats {
+    double min;
+    double max;
+    double avg;
+    int samples;
+};
+
 string sensors();
+double sensors_package();
+
+/*
+ * Sampling engine: libsensors is initialised once, every temperature,
+ * fan, voltage, current and power input becomes a channel, and a
+ * background thread samples all channels rate times per second into a
+ * ring buffer that readers access without taking a lock.
+ */
+bool sensors_start(double rate);
+void sensors_stop();
+vector<string> sensors_channels();
+double sensors_read(int channel);
+sensor_stats sensors_window(int channel, double seconds);
+
 char *degree_sign();
 string record_sign();
 #endif
\ No newline at end of file
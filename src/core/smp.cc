@@ -10,12 +10,52 @@
 #include <fcntl.h>
 #include <string.h>
 #include <unistd.h>
+#include <sys/mman.h>
+
+#include <vector>
 
 #include "osutils.h"
 
+#define SYSFS_MADT "/sys/firmware/acpi/tables/APIC"
+
+/* MADT (ACPI Multiple APIC Description Table) interrupt controller structures */
+#define MADT_LOCAL_APIC         0
+#define MADT_IO_APIC            1
+#define MADT_LOCAL_X2APIC       9
+#define MADT_GICC               11
+
+#define MADT_HEADER_SIZE        44
+#define MADT_FLAG_ENABLED       0x01
+#define MADT_FLAG_PCAT_COMPAT   0x01
 
 #if defined(__i386__)
 
+// finds or creates the node of the i-th enabled processor
+static hwNode *findCPU(hwNode & n, int i)
+{
+    hwNode *cpu = n.findChildByBusInfo("cpu@" + tostring(i));
+
+    if(!cpu)
+    {
+        hwNode *core = n.getChild("core");
+
+        if(!core)
+        {
+            n.addChild(hwNode("core", hw::bus));
+            core = n.getChild("core");
+        }
+        if(!core)
+            cpu = n.addChild(hwNode("cpu", hw::processor));
+        else
+            cpu = core->addChild(hwNode("cpu", hw::processor));
+
+        if(cpu)
+            cpu->setBusInfo("cpu@" + tostring(i));
+    }
+
+    return cpu;
+}
+
 typedef unsigned long vm_offset_t;
 
 /* MP Floating Pointer Structure */
@@ -86,146 +126,89 @@ typedef struct PROCENTRY
 
 #define MAXPNSTR                                132
 
-static int pfd = -1;
-
-static bool seekEntry(vm_offset_t addr)
+// maps len bytes of /dev/mem (fd) at addr, the mapping is page-aligned
+static uint8_t *mapEntry(int fd, vm_offset_t addr, size_t len)
 {
-    return(lseek(pfd, (off_t) addr, SEEK_SET) >= 0);
-}
+    size_t mmoffset = addr % getpagesize();
+    void *mmp = mmap(0, mmoffset + len, PROT_READ, MAP_SHARED, fd, addr - mmoffset);
 
-static bool readEntry(void* entry, int size)
-{
-    return(read(pfd, entry, size) == size);
+    if(mmp == MAP_FAILED)
+        return NULL;
+
+    return (uint8_t *) mmp + mmoffset;
 }
 
-static int readType(void)
+static void unmapEntry(uint8_t *p, size_t len)
 {
-    uint8_t type;
-
-    if(read(pfd, &type, sizeof( type)) == sizeof( type))
-        lseek(pfd, -sizeof( type), SEEK_CUR);
+    size_t mmoffset = (vm_offset_t) p % getpagesize();
 
-    return(int) type;
+    munmap(p - mmoffset, mmoffset + len);
 }
 
-
-/*
- * set PHYSICAL address of MP floating pointer structure
- */
-#define NEXT(X)         ((X) += 4)
-
-static int apic_probe(vm_offset_t* paddr)
+// looks for the MP floating pointer signature in one mapping of the area
+static bool searchArea(int fd, vm_offset_t target, size_t len, vm_offset_t* paddr)
 {
-    unsigned int x;
-    uint16_t segment;
-    vm_offset_t target;
-    unsigned int buffer[BIOS_SIZE];
+    uint8_t *area = mapEntry(fd, target, len);
     const char MP_SIG[] = "_MP_";
 
-    /* search Extended Bios Data Area, if present */
-    seekEntry((vm_offset_t) EBDA_POINTER);
-    readEntry(&segment, 2);
-    if(segment)
-    { /* search EBDA */
-        target = (vm_offset_t) segment << 4;
-        seekEntry(target);
-        readEntry(buffer, ONE_KBYTE);
-
-        for(x = 0; x < ONE_KBYTE / 4; NEXT(x))
-        {
-            if(!strncmp((char *) &buffer[x], MP_SIG, 4))
-            {
-                *paddr = (x * 4) + target;
-                return 1;
-            }
-        }
-    }
-
-    /* read CMOS for real top of mem */
-    seekEntry((vm_offset_t) TOPOFMEM_POINTER);
-    readEntry(&segment, 2);
-    --segment; /* less ONE_KBYTE */
-    target = segment * 1024;
-    seekEntry(target);
-    readEntry(buffer, ONE_KBYTE);
+    if(!area)
+        return false;
 
-    for(x = 0; x < ONE_KBYTE / 4; NEXT(x))
+    for(size_t x = 0; x + sizeof(mpfps_t) <= len; x += 16)
     {
-        if(!strncmp((char *) &buffer[x], MP_SIG, 4))
+        if(!memcmp(area + x, MP_SIG, 4))
         {
-            *paddr = (x * 4) + target;
-            return 2;
+            *paddr = target + x;
+            unmapEntry(area, len);
+            return true;
         }
     }
-    /* we don't necessarily believe CMOS, check base of the last 1K of 640K */
-    if(target != (DEFAULT_TOPOFMEM - 1024))
-    {
-        target = (DEFAULT_TOPOFMEM - 1024);
-        seekEntry(target);
-        readEntry(buffer, ONE_KBYTE);
 
-        for(x = 0; x < ONE_KBYTE / 4; NEXT(x))
-        {
-            if(!strncmp((char *) &buffer[x], MP_SIG, 4))
-            {
-                *paddr = (x * 4) + target;
-                return 3;
-            }
-        }
-    }
+    unmapEntry(area, len);
+    return false;
+}
 
-    /* search the BIOS */
-    seekEntry(BIOS_BASE);
-    readEntry(buffer, BIOS_SIZE);
+/*
+ * set PHYSICAL address of MP floating pointer structure
+ */
+static int apic_probe(int fd, vm_offset_t* paddr)
+{
+    uint16_t ebda = 0;
+    uint16_t basemem = 0;
+    vm_offset_t target;
+    uint8_t *bda = mapEntry(fd, 0, TOPOFMEM_POINTER + 2);
 
-    for(x = 0; x < BIOS_SIZE / 4; NEXT(x))
+    /* the BIOS data area gives the EBDA segment and the base memory size */
+    if(bda)
     {
-        if(!strncmp((char *) &buffer[x], MP_SIG, 4))
-        {
-            *paddr = (x * 4) + BIOS_BASE;
-            return 4;
-        }
+        memcpy(&ebda, bda + EBDA_POINTER, 2);
+        memcpy(&basemem, bda + TOPOFMEM_POINTER, 2);
+        unmapEntry(bda, TOPOFMEM_POINTER + 2);
     }
 
-    /* search the extended BIOS */
-    seekEntry(BIOS_BASE2);
-    readEntry(buffer, BIOS_SIZE);
-
-    for(x = 0; x < BIOS_SIZE / 4; NEXT(x))
-    {
-        if(!strncmp((char *) &buffer[x], MP_SIG, 4))
-        {
-            *paddr = (x * 4) + BIOS_BASE2;
-            return 4;
-        }
-    }
+    /* search Extended Bios Data Area, if present */
+    if(ebda && searchArea(fd, (vm_offset_t) ebda << 4, ONE_KBYTE, paddr))
+        return 1;
 
-    /* search additional memory */
-    target = GROPE_AREA1;
-    seekEntry(target);
-    readEntry(buffer, GROPE_SIZE);
+    /* CMOS real top of mem, less ONE_KBYTE */
+    target = (vm_offset_t) (uint16_t) (basemem - 1) * ONE_KBYTE;
+    if(searchArea(fd, target, ONE_KBYTE, paddr))
+        return 2;
 
-    for(x = 0; x < GROPE_SIZE / 4; NEXT(x))
-    {
-        if(!strncmp((char *) &buffer[x], MP_SIG, 4))
-        {
-            *paddr = (x * 4) + GROPE_AREA1;
-            return 5;
-        }
-    }
+    /* we don't necessarily believe CMOS, check base of the last 1K of 640K */
+    if((target != (DEFAULT_TOPOFMEM - ONE_KBYTE)) &&
+        searchArea(fd, DEFAULT_TOPOFMEM - ONE_KBYTE, ONE_KBYTE, paddr))
+        return 3;
 
-    target = GROPE_AREA2;
-    seekEntry(target);
-    readEntry(buffer, GROPE_SIZE);
+    /* search the BIOS and the extended BIOS */
+    if(searchArea(fd, BIOS_BASE, BIOS_SIZE, paddr) || searchArea(fd, BIOS_BASE2, BIOS_SIZE, paddr))
+        return 4;
 
-    for(x = 0; x < GROPE_SIZE / 4; NEXT(x))
-    {
-        if(!strncmp((char *) &buffer[x], MP_SIG, 4))
-        {
-            *paddr = (x * 4) + GROPE_AREA2;
-            return 6;
-        }
-    }
+    /* search additional memory */
+    if(searchArea(fd, GROPE_AREA1, GROPE_SIZE, paddr))
+        return 5;
+    if(searchArea(fd, GROPE_AREA2, GROPE_SIZE, paddr))
+        return 6;
 
     *paddr = (vm_offset_t) 0;
     return 0;
@@ -238,24 +221,7 @@ static hwNode *addCPU(hwNode & n, int i, ProcEntry entry)
     if(!(entry.cpuFlags & PROCENTRY_FLAG_EN))
         return NULL;
 
-    cpu = n.findChildByBusInfo("cpu@" + tostring(i));
-    if(!cpu)
-    {
-        hwNode *core = n.getChild("core");
-
-        if(!core)
-        {
-            n.addChild(hwNode("core", hw::bus));
-            core = n.getChild("core");
-        }
-        if(!core)
-            cpu = n.addChild(hwNode("cpu", hw::processor));
-        else
-            cpu = core->addChild(hwNode("cpu", hw::processor));
-
-        if(cpu)
-            cpu->setBusInfo("cpu@" + tostring(i));
-    }
+    cpu = findCPU(n, i);
 
     if(cpu)
     {
@@ -322,27 +288,34 @@ static void MPConfigDefault(hwNode & n, int featureByte)
     n.setConfig("cpus", 2);
 }
 
-static void MPConfigTableHeader(hwNode & n, uint32_t pap)
+static void MPConfigTableHeader(int fd, hwNode & n, uint32_t pap)
 {
     mpcth_t cth;
+    uint8_t *table = NULL;
+    uint8_t *entry = NULL;
+    uint8_t *end = NULL;
     int c;
-    int entrytype;
     int ncpu = 0;
     int nbus = 0;
     int napic = 0;
     int nintr = 0;
-    ProcEntry entry;
+    ProcEntry proc;
 
     if(!pap)
         return;
 
-    /* read in cth structure */
-    seekEntry(pap);
-    readEntry(&cth, sizeof( cth));
-
+    /* read in cth structure, then map the whole base table at once */
+    if(!(table = mapEntry(fd, pap, sizeof(cth))))
+        return;
+    memcpy(&cth, table, sizeof(cth));
+    unmapEntry(table, sizeof(cth));
 
     if(string(cth.signature, 4) != "PCMP")
         return;
+    if(cth.base_table_length < sizeof(cth))
+        return;
+    if(!(table = mapEntry(fd, pap, cth.base_table_length)))
+        return;
 
     if(n.getVendor() == "")
         n.setVendor(hw::strip(string(cth.oem_id, 8)));
@@ -351,39 +324,51 @@ static void MPConfigTableHeader(hwNode & n, uint32_t pap)
 
     n.addCapability("smp-1." + tostring(cth.spec_rev), "SMP specification v1." + tostring(cth.spec_rev));
 
-    for(c = cth.entry_count; c; c--)
+    entry = table + sizeof(cth);
+    end = table + cth.base_table_length;
+    for(c = cth.entry_count; c && (entry < end); c--)
     {
-        entrytype = readType();
-        switch(entrytype)
+        switch(*entry)
         {
             case 0:
-                readEntry(&entry, sizeof( entry));
-                if(addCPU(n, ncpu, entry))
+                if(entry + sizeof(proc) > end)
+                {
+                    c = 1;
+                    break;
+                }
+                memcpy(&proc, entry, sizeof(proc));
+                if(addCPU(n, ncpu, proc))
                     ncpu++;
+                entry += sizeof(proc);
                 break;
 
             case 1:
                 //busEntry();
                 nbus++;
+                entry += 8;
                 break;
 
             case 2:
                 //ioApicEntry();
                 napic++;
+                entry += 8;
                 break;
 
             case 3:
                 //intEntry();
-                nintr++;
-                break;
-
             case 4:
                 //intEntry();
                 nintr++;
+                entry += 8;
+                break;
+
+            default:                              // unknown entry, size unknown
+                c = 1;
                 break;
         }
     }
 
+    unmapEntry(table, cth.base_table_length);
     n.setConfig("cpus", ncpu);
 }
 
@@ -391,28 +376,36 @@ bool issmp(hwNode & n)
 {
     vm_offset_t paddr;
     mpfps_t mpfps;
+    uint8_t *fps = NULL;
+    int fd = -1;
 
-    if((pfd = open("/dev/mem", O_RDONLY)) < 0)
+    if((fd = open("/dev/mem", O_RDONLY)) < 0)
         return false;
 
-    if(apic_probe(&paddr) <= 0)
+    if((apic_probe(fd, &paddr) <= 0) || !(fps = mapEntry(fd, paddr, sizeof(mpfps_t))))
+    {
+        close(fd);
         return false;
+    }
 
     /* read in mpfps structure*/
-    seekEntry(paddr);
-    readEntry(&mpfps, sizeof(mpfps_t));
+    memcpy(&mpfps, fps, sizeof(mpfps_t));
+    unmapEntry(fps, sizeof(mpfps_t));
 
     if(string(mpfps.signature, 4) != "_MP_")
+    {
+        close(fd);
         return false;
+    }
 
     /* check whether a pre-defined MP config table exists */
     if(mpfps.mpfb1)
         MPConfigDefault(n, mpfps.mpfb1);
     else
         if(mpfps.pap)
-        MPConfigTableHeader(n, mpfps.pap);
+        MPConfigTableHeader(fd, n, mpfps.pap);
 
-    close(pfd);
+    close(fd);
     return true;
 }
 
@@ -425,9 +418,90 @@ bool issmp(hwNode & n)
 
 #endif
 
+static uint32_t le32(const uint8_t *p)
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t) p[3] << 24);
+}
+
+/*
+ * ACPI MADT, as exported by the kernel: counts the enabled processors
+ * (local APIC, x2APIC or GIC CPU interface) and the I/O APICs without
+ * touching /dev/mem. Its entries are logical processors, so the cpu@N
+ * nodes, numbered by package, are left to the other probers.
+ */
+static bool scan_madt(hwNode & n)
+{
+    vector < uint8_t > madt;
+    uint8_t buffer[4096];
+    uint8_t sum = 0;
+    ssize_t count = 0;
+    size_t length = 0;
+    int ncpu = 0;
+    int napic = 0;
+    int fd = open(SYSFS_MADT, O_RDONLY);
+
+    if(fd < 0)
+        return false;
+    while((count = read(fd, buffer, sizeof(buffer))) > 0)
+        madt.insert(madt.end(), buffer, buffer + count);
+    close(fd);
+
+    if((madt.size() < MADT_HEADER_SIZE) || memcmp(&madt[0], "APIC", 4))
+        return false;
+    length = le32(&madt[4]);
+    if((length < MADT_HEADER_SIZE) || (length > madt.size()))
+        return false;
+    for(size_t i = 0; i < length; i++)
+        sum += madt[i];
+    if(sum != 0)
+        return false;
+
+    for(size_t offset = MADT_HEADER_SIZE; offset + 2 <= length; offset += madt[offset + 1])
+    {
+        const uint8_t *entry = &madt[offset];
+        uint32_t flags = 0;
+
+        if((entry[1] < 2) || (offset + entry[1] > length))
+            break;
+
+        switch(entry[0])
+        {
+            case MADT_LOCAL_APIC:
+                if(entry[1] < 8)
+                    continue;
+                flags = le32(entry + 4);
+                break;
+            case MADT_LOCAL_X2APIC:
+                if(entry[1] < 16)
+                    continue;
+                flags = le32(entry + 8);
+                break;
+            case MADT_GICC:
+                if(entry[1] < 16)
+                    continue;
+                flags = le32(entry + 12);
+                break;
+            case MADT_IO_APIC:
+                napic++;
+                continue;
+            default:
+                continue;
+        }
+
+        if(flags & MADT_FLAG_ENABLED)
+            ncpu++;
+    }
+
+    if(napic > 0)
+        n.setConfig("ioapics", napic);
+    n.setConfig("cpus", ncpu);
+
+    return ncpu > 0;
+}
+
 bool scan_smp(hwNode & n)
 {
-    if(issmp(n))
+    if(scan_madt(n) || issmp(n))
     {
         n.addCapability("smp", "Symmetric Multi-Processing");
         return true;
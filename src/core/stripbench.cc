@@ -0,0 +1,55 @@
+/*
+ * stripbench.cc
+ *
+ * Microbenchmark of hw::strip(), which runs on every string stored in
+ * the tree, over real identification strings: the names in pci.ids and
+ * the lines of /proc/cpuinfo.
+ */
+
+#include <sys/time.h>
+#include <vector>
+#include "hw.h"
+#include "osutils.h"
+#include "stripbench.h"
+
+#define DEFAULT_CORPUS "/usr/share/hwdata/pci.ids:/usr/share/misc/pci.ids:/usr/share/pci.ids:/proc/cpuinfo"
+
+static double now()
+{
+    struct timeval tp;
+
+    gettimeofday(&tp, NULL);
+    return (double) tp.tv_sec + (double) tp.tv_usec * 1.e-6;
+}
+
+double strip_bench(const string & corpus, double seconds)
+{
+    vector < string > files;
+    vector < string > lines;
+    unsigned long long count = 0;
+    unsigned long long length = 0;
+    double start = 0, elapsed = 0;
+
+    splitlines(corpus == "" ? DEFAULT_CORPUS : corpus, files, ':');
+    for(unsigned int i = 0; i < files.size(); i++)
+    {
+        vector < string > content;
+
+        if(loadfile(files[i], content))
+            lines.insert(lines.end(), content.begin(), content.end());
+    }
+    if(lines.empty())
+        return 0;
+
+    start = now();
+    do
+    {
+        for(unsigned int i = 0; i < lines.size(); i++)
+            length += hw::strip(lines[i]).length();
+        count += lines.size();
+        elapsed = now() - start;
+    } while(elapsed < seconds);
+
+    // length keeps the calls from being optimized away
+    return (length > 0) ? count / elapsed : 0;
+}
@@ -0,0 +1,14 @@
+#ifndef _STRIPBENCH_H_
+#define _STRIPBENCH_H_
+
+#include <string>
+
+using namespace std;
+
+/*
+ * hw::strip() throughput over the lines of the corpus files (a ':'
+ * separated list, pci.ids and /proc/cpuinfo when empty), in strings per
+ * second
+ */
+double strip_bench(const string & corpus, double seconds);
+#endif
@@ -6,6 +6,9 @@
 
 #include "sysfs.h"
 #include "osutils.h"
+#include "options.h"
+#include "heuristics.h"
+#include "scancontext.h"
 #include <limits.h>
 #include <unistd.h>
 #include <stdlib.h>
@@ -16,6 +19,13 @@
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <sys/mount.h>
+#include <sys/syscall.h>
+#include <fcntl.h>
+#include <pthread.h>
+
+#include <map>
+#include <vector>
+#include <algorithm>
 
 
 using namespace sysfs;
@@ -80,6 +90,55 @@ struct sysfs_t
 
 static sysfs_t fs;
 
+/*
+ * index of /sys/devices: directory name -> path below it, built once with
+ * openat()/getdents64() and shared by all lookups until sysfs_reset()
+ */
+struct linux_dirent64
+{
+    u_int64_t d_ino;
+    int64_t d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[];
+};
+
+struct device_index
+{
+    bool built;
+    map < string, string > paths;
+    map < string, unsigned int > depths;
+    vector < string > classes;
+};
+
+// per scan context: the sysfs root and the index of its devices
+struct sysfs_state : public scan_state
+{
+    sysfs_state(const string & p) : path(p)
+    {
+        devices.built = false;
+    }
+
+    string path;
+    device_index devices;
+};
+
+static sysfs_state & current_sysfs()
+{
+    ScanContext & context = scan_context();
+    const string & root = context.sysfs_root.empty() ? fs.path : context.sysfs_root;
+
+    // the root was changed since the last scan: its index is stale
+    if(context.sysfs && static_cast < sysfs_state * >(context.sysfs)->path != root)
+    {
+        delete context.sysfs;
+        context.sysfs = NULL;
+    }
+    if(!context.sysfs)
+        context.sysfs = new sysfs_state(root);
+    return *static_cast < sysfs_state * >(context.sysfs);
+}
+
 static string sysfs_getbustype(const string & path)
 {
     struct dirent **namelist;
@@ -93,14 +152,14 @@ static string sysfs_getbustype(const string & path)
       - check if this link and 'path' point to the same inode
       - if they do, the bus type is the name of the current directory
      */
-    pushd(fs.path + "/bus");
+    pushd(current_sysfs().path + "/bus");
     n = scandir(".", &namelist, selectdir, alphasort);
     popd();
 
     for(i = 0; i < n; i++)
     {
         devname =
-                string(fs.path + "/bus/") + string(namelist[i]->d_name) +
+                string(current_sysfs().path + "/bus/") + string(namelist[i]->d_name) +
                 "/devices/" + basename((char *) path.c_str());
 
         if(samefile(devname, path))
@@ -142,7 +201,7 @@ static string sysfstobusinfo(const string & path)
 static string sysfs_getbusinfo_byclass(const string & devclass, const string & devname)
 {
     string device =
-            fs.path + string("/class/") + devclass + string("/") + devname + "/device";
+            current_sysfs().path + string("/class/") + devclass + string("/") + devname + "/device";
     string result = "";
     int i = 0;
 
@@ -160,7 +219,7 @@ static string sysfs_getbusinfo_byclass(const string & devclass, const string & d
 static string sysfs_getbusinfo_bybus(const string & devbus, const string & devname)
 {
     string device =
-            fs.path + string("/bus/") + devbus + string("/devices/") + devname;
+            current_sysfs().path + string("/bus/") + devbus + string("/devices/") + devname;
     char buffer[PATH_MAX + 1];
 
     if(!realpath(device.c_str(), buffer))
@@ -178,52 +237,139 @@ string sysfs_getbusinfo(const entry & e)
     return "";
 }
 
-static string finddevice(const string & name, const string & root = "")
+
+// names of the entries of an open directory, only the subdirectories if asked
+static void read_entries(int dirfd, vector < string > & entries, bool subdirs)
 {
-    struct dirent **namelist;
-    int n;
-    string result = "";
+    char buffer[8192];
+    long count = 0;
 
-    if(exists(name))
-        return root + "/" + name;
+    while((count = syscall(SYS_getdents64, dirfd, buffer, sizeof(buffer))) > 0)
+        for(long pos = 0; pos < count;)
+        {
+            struct linux_dirent64 *d = (struct linux_dirent64 *) (buffer + pos);
+            struct stat buf;
+
+            pos += d->d_reclen;
+            if(d->d_name[0] == '.')
+                continue;
+            if(!subdirs || (d->d_type == DT_DIR) ||
+                ((d->d_type == DT_UNKNOWN) && (fstatat(dirfd, d->d_name, &buf, AT_SYMLINK_NOFOLLOW) == 0) &&
+                S_ISDIR(buf.st_mode)))
+                entries.push_back(d->d_name);
+        }
 
-    n = scandir(".", &namelist, selectdir, alphasort);
+    sort(entries.begin(), entries.end());
+}
+
+static void index_devices(int dirfd, const string & path, unsigned int depth)
+{
+    device_index & devices = current_sysfs().devices;
+    vector < string > subdirs;
 
-    for(int i = 0; i < n; i++)
+    read_entries(dirfd, subdirs, true);
+    for(unsigned int i = 0; i < subdirs.size(); i++)
     {
-        pushd(namelist[i]->d_name);
-        string findinchild = finddevice(name, root + "/" + string(namelist[i]->d_name));
-        popd();
+        string child = path + "/" + subdirs[i];
+        map < string, unsigned int >::iterator known = devices.depths.find(subdirs[i]);
+        int fd = -1;
 
-        free(namelist[i]);
-        if(findinchild != "")
+        // the shallowest directory wins
+        if((known == devices.depths.end()) || (known->second > depth))
         {
-            result = findinchild;
+            devices.paths[subdirs[i]] = child;
+            devices.depths[subdirs[i]] = depth;
+        }
+
+        fd = openat(dirfd, subdirs[i].c_str(), O_RDONLY | O_DIRECTORY | O_NOFOLLOW);
+        if(fd >= 0)
+        {
+            index_devices(fd, child, depth + 1);
+            close(fd);
         }
     }
-    free(namelist);
+}
 
-    return result;
+static void build_index()
+{
+    device_index & devices = current_sysfs().devices;
+    int fd = open((current_sysfs().path + "/devices").c_str(), O_RDONLY | O_DIRECTORY);
+
+    devices.built = true;
+    devices.classes = list_dir(current_sysfs().path + "/class");
+    if(fd < 0)
+        return;
+    index_devices(fd, "", 0);
+    close(fd);
 }
 
+void sysfs_reset()
+{
+    device_index & devices = current_sysfs().devices;
+    devices.built = false;
+    devices.paths.clear();
+    devices.depths.clear();
+    devices.classes.clear();
+}
+
+// most devices are a /sys/class/<class>/<name> or /sys/block/<name> link
+static string finddevice_bylink(const string & name)
+{
+    device_index & devices = current_sysfs().devices;
+    string prefix = realpath(current_sysfs().path + "/devices");
+    vector < string > links;
+
+    for(unsigned int i = 0; i < devices.classes.size(); i++)
+        links.push_back(current_sysfs().path + "/class/" + devices.classes[i] + "/" + name);
+    links.push_back(current_sysfs().path + "/block/" + name);
+
+    for(unsigned int i = 0; i < links.size(); i++)
+    {
+        string target = "";
+
+        if(!exists(links[i]))
+            continue;
+        target = realpath(links[i]);
+        if((target.length() > prefix.length()) && (target.compare(0, prefix.length() + 1, prefix + "/") == 0))
+            return target.substr(prefix.length());
+    }
+
+    return "";
+}
+
+// path of the device below /sys/devices, starting with '/'
 string sysfs_finddevice(const string & name)
 {
-    string devices = fs.path + string("/devices/");
+    device_index & devices = current_sysfs().devices;
+    string devname = name;
     string result = "";
-
-    if(!pushd(devices))
+    map < string, string >::iterator i;
+
+    // "/dev/sda" -> "sda", "/dev/cciss/c0d0" -> "cciss!c0d0"
+    if(devname.compare(0, 5, "/dev/") == 0)
+        devname = devname.substr(5);
+    for(unsigned int j = 0; j < devname.length(); j++)
+        if(devname[j] == '/')
+            devname[j] = '!';
+    if(devname == "")
         return "";
-    result = finddevice(name);
-    popd();
 
-    return result;
+    if(!devices.built)
+        build_index();
+
+    result = finddevice_bylink(devname);
+    if(result != "")
+        return result;
+
+    i = devices.paths.find(devname);
+    return (i != devices.paths.end()) ? i->second : "";
 }
 
 string sysfs_getdriver(const string & devclass,
         const string & devname)
 {
     string driverpath =
-            fs.path + string("/class/") + devclass + string("/") + devname + "/";
+            current_sysfs().path + string("/class/") + devclass + string("/") + devname + "/";
     string driver = driverpath + "/driver";
     char buffer[PATH_MAX + 1];
     int namelen = 0;
@@ -281,15 +427,457 @@ entry::~entry()
 bool entry::hassubdir(const string & s)
 {
     if(This->devclass != "")
-        return exists(fs.path + string("/class/") + This->devclass + string("/") + This->devname + "/" + s);
+        return exists(current_sysfs().path + string("/class/") + This->devclass + string("/") + This->devname + "/" + s);
 
     if(This->devbus != "")
-        return exists(fs.path + string("/bus/") + This->devbus + string("/devices/") + This->devname + string("/") + s);
+        return exists(current_sysfs().path + string("/bus/") + This->devbus + string("/devices/") + This->devname + string("/") + s);
 
     return false;
 }
 
-bool scan_sysfs(hwNode & n)
+/*
+ * generic prober: every device below /sys/devices that sits on a bus
+ * without a dedicated scanner (platform, virtio, i2c, thunderbolt, mdev...)
+ * becomes a node under its closest known ancestor.
+ *
+ * the tree is walked once, in parallel: each worker takes whole subtrees of
+ * /sys/devices and only records what it finds, the nodes are built
+ * afterwards in path order so that parents always come before children.
+ */
+
+#define SYSFS_WORKERS 8
+
+// scanned by a dedicated prober, or kernel objects rather than hardware
+static const char *ignored_buses[] =
+{
+    "pci", "pci_express", "usb", "scsi", "pcmcia", "ide",
+    "cpu", "memory", "memory_tiering", "node", "container", "machinecheck",
+    "clockevents", "clocksource", "event_source", "workqueue", "edac",
+    "acpi", "serial-base", "faux",
+    NULL
+};
+
+struct bus_description
+{
+    const char *bus;
+    hw::hwClass devclass;
+    const char *description;
+    const char *product;                          // attributes, may be NULL
+    const char *vendor;
+};
+
+static const struct bus_description buses[] =
+{
+    {"platform", hw::generic, "platform device", NULL, NULL},
+    {"pnp", hw::generic, "PnP device", "id", NULL},
+    {"virtio", hw::generic, "Virtio device", NULL, NULL},
+    {"i2c", hw::generic, "I2C device", "name", NULL},
+    {"spi", hw::generic, "SPI device", NULL, NULL},
+    {"serio", hw::input, "serial I/O port", "description", NULL},
+    {"hid", hw::input, "HID device", NULL, NULL},
+    {"mmc", hw::storage, "MMC card", "name", NULL},
+    {"sdio", hw::generic, "SDIO function", NULL, NULL},
+    {"thunderbolt", hw::bus, "Thunderbolt device", "device_name", "vendor_name"},
+    {"mdev", hw::generic, "mediated device", "mdev_type/name", NULL},
+    {"nd", hw::memory, "NVDIMM device", NULL, NULL},
+    {"wmi", hw::generic, "WMI device", NULL, NULL},
+    {NULL, hw::generic, NULL, NULL, NULL}
+};
+
+// virtio device IDs, from the virtio specification
+static const struct
+{
+    unsigned int id;
+    hw::hwClass devclass;
+    const char *description;
+} virtio_devices[] =
+{
+    {1, hw::network, "Virtio network device"},
+    {2, hw::storage, "Virtio block device"},
+    {3, hw::communication, "Virtio console"},
+    {4, hw::generic, "Virtio RNG"},
+    {5, hw::memory, "Virtio memory balloon"},
+    {8, hw::storage, "Virtio SCSI"},
+    {9, hw::storage, "Virtio 9P transport"},
+    {16, hw::display, "Virtio GPU"},
+    {18, hw::input, "Virtio input"},
+    {19, hw::communication, "Virtio socket"},
+    {20, hw::generic, "Virtio crypto"},
+    {26, hw::storage, "Virtio filesystem"},
+    {0, hw::generic, NULL}
+};
+
+struct sysfs_device
+{
+    string path;                                  // below /sys/devices
+    string bus;
+    string driver;
+    string modalias;
+    string numa;
+    string power;
+    string irq;
+    string product;
+    string vendor;
+};
+
+typedef void (*sysfs_collector)(int dirfd, const string & path, vector < sysfs_device > & found);
+
+struct sysfs_walk
+{
+    sysfs_collector collect;
+    int root;
+    vector < string > subtrees;
+    vector < vector < sysfs_device > > found;
+    long next;
+};
+
+static bool ignored_bus(const string & bus)
 {
+    for(unsigned int i = 0; ignored_buses[i]; i++)
+        if(bus == ignored_buses[i])
+            return true;
     return false;
 }
+
+static const struct bus_description *find_bus(const string & bus)
+{
+    for(unsigned int i = 0; buses[i].bus; i++)
+        if(bus == buses[i].bus)
+            return &buses[i];
+    return NULL;
+}
+
+static string read_attribute(int dirfd, const char *name)
+{
+    char buffer[4096];                            // one page, the most an attribute holds
+    ssize_t len = 0;
+    int fd = openat(dirfd, name, O_RDONLY);
+
+    if(fd < 0)
+        return "";
+    len = read(fd, buffer, sizeof(buffer));
+    close(fd);
+
+    return (len > 0) ? hw::strip(string(buffer, len)) : "";
+}
+
+static string read_link(int dirfd, const char *name)
+{
+    char buffer[PATH_MAX + 1];
+    ssize_t len = readlinkat(dirfd, name, buffer, sizeof(buffer) - 1);
+
+    if(len <= 0)
+        return "";
+
+    return string(buffer, len);
+}
+
+static string last_component(const string & path)
+{
+    size_t slash = path.rfind('/');
+
+    return (slash == string::npos) ? path : path.substr(slash + 1);
+}
+
+// legacy interrupt, or the MSI vectors when the device uses them
+static string device_irqs(int dirfd)
+{
+    vector < string > vectors;
+    string result = "";
+    int fd = openat(dirfd, "msi_irqs", O_RDONLY | O_DIRECTORY);
+
+    if(fd >= 0)
+    {
+        read_entries(fd, vectors, false);
+        close(fd);
+    }
+    for(unsigned int i = 0; i < vectors.size(); i++)
+        result += (i ? " " : "") + vectors[i];
+    if(result != "")
+        return result;
+
+    result = read_attribute(dirfd, "irq");
+    return (result == "0") ? "" : result;
+}
+
+static void collect_device(int dirfd, const string & path, vector < sysfs_device > & found)
+{
+    string subsystem = read_link(dirfd, "subsystem");
+    size_t pos = subsystem.rfind("/bus/");
+    const struct bus_description *desc = NULL;
+    sysfs_device d;
+
+    // class devices (net, block, tty...) are left to their own probers
+    if((pos == string::npos) && (subsystem.compare(0, 4, "bus/") != 0))
+        return;
+
+    d.path = path;
+    d.bus = last_component(subsystem);
+    if(ignored_bus(d.bus))
+        return;
+
+    d.driver = last_component(read_link(dirfd, "driver"));
+    d.modalias = read_attribute(dirfd, "modalias");
+    d.numa = read_attribute(dirfd, "numa_node");
+    if(d.numa == "-1")
+        d.numa = "";
+    d.power = read_attribute(dirfd, "power/runtime_status");
+    if(d.power == "unsupported")
+        d.power = "";
+    d.irq = device_irqs(dirfd);
+
+    desc = find_bus(d.bus);
+    if(desc && desc->product)
+        d.product = read_attribute(dirfd, desc->product);
+    if(desc && desc->vendor)
+        d.vendor = read_attribute(dirfd, desc->vendor);
+
+    found.push_back(d);
+}
+
+/*
+ * any device exposing a modalias (ssb devices only have it in uevent),
+ * unless it is bound to a driver built into the kernel
+ */
+static void collect_modalias(int dirfd, const string & path, vector < sysfs_device > & found)
+{
+    sysfs_device d;
+
+    d.modalias = read_attribute(dirfd, "modalias");
+    if((d.modalias == "") && (path.find("ssb") != string::npos))
+    {
+        vector < string > lines;
+
+        splitlines(read_attribute(dirfd, "uevent"), lines);
+        for(unsigned int i = 0; i < lines.size(); i++)
+            if(lines[i].compare(0, 9, "MODALIAS=") == 0)
+                d.modalias = hw::strip(lines[i].substr(9));
+    }
+    if(d.modalias == "")
+        return;
+
+    d.driver = last_component(read_link(dirfd, "driver"));
+    if((d.driver != "") && (read_link(dirfd, "driver/module") == ""))
+        return;
+
+    d.path = path;
+    found.push_back(d);
+}
+
+static void collect_devices(sysfs_collector collect, int dirfd, const string & path, vector < sysfs_device > & found)
+{
+    vector < string > subdirs;
+
+    collect(dirfd, path, found);
+
+    read_entries(dirfd, subdirs, true);
+    for(unsigned int i = 0; i < subdirs.size(); i++)
+    {
+        int fd = -1;
+
+        if(subdirs[i] == "power")
+            continue;
+        fd = openat(dirfd, subdirs[i].c_str(), O_RDONLY | O_DIRECTORY | O_NOFOLLOW);
+        if(fd >= 0)
+        {
+            collect_devices(collect, fd, path + "/" + subdirs[i], found);
+            close(fd);
+        }
+    }
+}
+
+static void *walk_subtrees(void *arg)
+{
+    struct sysfs_walk *walk = (struct sysfs_walk *) arg;
+    long i = 0;
+
+    while((i = __sync_fetch_and_add(&walk->next, 1)) < (long) walk->subtrees.size())
+    {
+        int fd = openat(walk->root, walk->subtrees[i].c_str() + 1, O_RDONLY | O_DIRECTORY | O_NOFOLLOW);
+
+        if(fd < 0)
+            continue;
+        collect_devices(walk->collect, fd, walk->subtrees[i], walk->found[i]);
+        close(fd);
+    }
+
+    return NULL;
+}
+
+static bool by_path(const sysfs_device & a, const sysfs_device & b)
+{
+    return a.path < b.path;
+}
+
+static void walk_devices(vector < sysfs_device > & found, sysfs_collector collect = collect_device)
+{
+    struct sysfs_walk walk;
+    vector < string > top;
+    vector < pthread_t > threads;
+    long workers = sysconf(_SC_NPROCESSORS_ONLN);
+
+    walk.collect = collect;
+    walk.next = 0;
+    walk.root = open((current_sysfs().path + "/devices").c_str(), O_RDONLY | O_DIRECTORY);
+    if(walk.root < 0)
+        return;
+
+    // the first two levels are split into subtrees for the workers
+    read_entries(walk.root, top, true);
+    for(unsigned int i = 0; i < top.size(); i++)
+    {
+        vector < string > subdirs;
+        int fd = openat(walk.root, top[i].c_str(), O_RDONLY | O_DIRECTORY | O_NOFOLLOW);
+
+        if(fd < 0)
+            continue;
+        collect(fd, "/" + top[i], found);
+        read_entries(fd, subdirs, true);
+        close(fd);
+
+        for(unsigned int j = 0; j < subdirs.size(); j++)
+            if(subdirs[j] != "power")
+                walk.subtrees.push_back("/" + top[i] + "/" + subdirs[j]);
+    }
+    walk.found.resize(walk.subtrees.size());
+
+    if(workers > SYSFS_WORKERS)
+        workers = SYSFS_WORKERS;
+    if(workers > (long) walk.subtrees.size())
+        workers = walk.subtrees.size();
+    for(long i = 1; i < workers; i++)
+    {
+        pthread_t thread;
+
+        if(pthread_create(&thread, NULL, walk_subtrees, &walk) != 0)
+            break;
+        threads.push_back(thread);
+    }
+    walk_subtrees(&walk);
+    for(unsigned int i = 0; i < threads.size(); i++)
+        pthread_join(threads[i], NULL);
+    close(walk.root);
+
+    for(unsigned int i = 0; i < walk.found.size(); i++)
+        found.insert(found.end(), walk.found[i].begin(), walk.found[i].end());
+    sort(found.begin(), found.end(), by_path);
+}
+
+// "virtio1" -> "virtio@1", "i2c-0" -> "i2c@0", "0-0050" -> "i2c@0-0050"
+static string device_businfo(const sysfs_device & d)
+{
+    string name = last_component(d.path);
+
+    if((name.length() > d.bus.length()) && (name.compare(0, d.bus.length(), d.bus) == 0))
+    {
+        name = name.substr(d.bus.length());
+        if(name[0] == '-')
+            name = name.substr(1);
+    }
+
+    return d.bus + "@" + name;
+}
+
+static hwNode device_node(const sysfs_device & d)
+{
+    const struct bus_description *desc = find_bus(d.bus);
+    hwNode device(d.bus, desc ? desc->devclass : hw::generic);
+    unsigned int id = 0;
+
+    device.setDescription(desc ? desc->description : d.bus + " device");
+    if((d.bus == "virtio") && (sscanf(d.modalias.c_str(), "virtio:d%xv", &id) == 1))
+        for(unsigned int i = 0; virtio_devices[i].description; i++)
+            if(virtio_devices[i].id == id)
+            {
+                device.setClass(virtio_devices[i].devclass);
+                device.setDescription(virtio_devices[i].description);
+            }
+
+    device.setBusInfo(device_businfo(d));
+    // platform devices are named after what they are
+    if(d.product != "")
+        device.setProduct(d.product);
+    else if(d.bus == "platform")
+        device.setProduct(last_component(d.path));
+    if(d.vendor != "")
+        device.setVendor(d.vendor);
+
+    if(d.driver != "")
+    {
+        device.setConfig("driver", d.driver);
+        device.claim();
+    }
+    if(d.modalias != "")
+        device.setConfig("modalias", d.modalias);
+    if(d.numa != "")
+        device.setConfig("numa_node", d.numa);
+    if(d.power != "")
+        device.setConfig("power", d.power);
+    if(d.irq != "")
+        device.setConfig("irq", d.irq);
+
+    return device;
+}
+
+static hwNode *device_parent(hwNode & n, const string & path, map < string, string > & attached)
+{
+    string ancestor = path;
+    size_t slash = 0;
+
+    while(((slash = ancestor.rfind('/')) != string::npos) && (slash > 0))
+    {
+        map < string, string >::iterator known;
+        string businfo = "";
+        hwNode *parent = NULL;
+
+        ancestor = ancestor.substr(0, slash);
+        known = attached.find(ancestor);
+        businfo = (known != attached.end()) ? known->second : guessBusInfo(last_component(ancestor));
+        if(businfo.find('@') != string::npos)
+            parent = n.findChildByBusInfo(businfo);
+        if(parent)
+            return parent;
+    }
+
+    if(hwNode *core = n.getChild("core"))
+        return core;
+    return &n;
+}
+
+bool scan_sysfs(hwNode & n)
+{
+    vector < sysfs_device > found;
+    map < string, string > attached;              // sysfs path -> businfo
+    bool result = false;
+
+    walk_devices(found);
+
+    for(unsigned int i = 0; i < found.size(); i++)
+    {
+        string businfo = device_businfo(found[i]);
+
+        if(!enabled(("sysfs:" + found[i].bus).c_str()))
+            continue;
+
+        if(!n.findChildByBusInfo(businfo))
+            device_parent(n, found[i].path, attached)->addChild(device_node(found[i]));
+        attached[found[i].path] = businfo;
+        result = true;
+    }
+
+    return result;
+}
+
+vector < string > sysfs_modaliases()
+{
+    vector < sysfs_device > found;
+    vector < string > result;
+
+    walk_devices(found, collect_modalias);
+    for(unsigned int i = 0; i < found.size(); i++)
+        result.push_back(found[i].modalias);
+    sort(result.begin(), result.end());
+    result.erase(unique(result.begin(), result.end()), result.end());
+
+    return result;
+}
@@ -36,4 +36,8 @@ bool scan_sysfs(hwNode & n);
 
 std::string sysfs_getbusinfo(const sysfs::entry &);
 std::string sysfs_finddevice(const string &name);
+void sysfs_reset();
+
+// modaliases of the devices not bound to a built-in driver, sorted
+vector < string > sysfs_modaliases();
 #endif
@@ -0,0 +1,211 @@
+/*
+ * telemetry.cc
+ *
+ * Sidecar sampling of per-CPU frequency (cpufreq scaling_cur_freq), CPU
+ * package temperature (libsensors, see sensors.cc) and RAPL package
+ * energy while a benchmark runs.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <time.h>
+#include "sensors.h"
+#include "telemetry.h"
+
+#define DEVICESCPUFREQ "/sys/devices/system/cpu/cpu%d/cpufreq/scaling_cur_freq"
+#define POWERCAP "/sys/class/powercap"
+
+struct rapl_domain
+{
+    int fd;
+    unsigned long long range;   // energy_uj wraps around at this value
+    unsigned long long last;
+    unsigned long long total;
+};
+
+static pthread_mutex_t telemetry_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_t sampler;
+static bool running = false;
+static long interval = 0;
+static double started = 0;
+static vector < int > freq_fds;
+static vector < rapl_domain > rapl;
+static telemetry series;
+
+static double now()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// sysfs attributes can be re-read from offset 0 without reopening them
+static bool read_ull(int fd, unsigned long long & value)
+{
+    char buffer[32];
+    ssize_t n = pread(fd, buffer, sizeof(buffer) - 1, 0);
+
+    if(n <= 0)
+        return false;
+    buffer[n] = '\0';
+    value = strtoull(buffer, NULL, 10);
+
+    return true;
+}
+
+static void open_sources()
+{
+    long cpus = sysconf(_SC_NPROCESSORS_CONF);
+    struct dirent **namelist;
+    int n;
+
+    for(long i = 0; i < cpus; i++)
+    {
+        char path[80];
+
+        snprintf(path, sizeof(path), DEVICESCPUFREQ, (int) i);
+        freq_fds.push_back(open(path, O_RDONLY));
+    }
+
+    // top level zones only ("intel-rapl:0"), subzones are part of them
+    n = scandir(POWERCAP, &namelist, NULL, alphasort);
+    for(int i = 0; i < n; i++)
+    {
+        const char *name = namelist[i]->d_name;
+
+        if(strncmp(name, "intel-rapl:", 11) == 0 && strchr(name + 11, ':') == NULL)
+        {
+            string zone = string(POWERCAP) + "/" + name;
+            int rangefd = open((zone + "/max_energy_range_uj").c_str(), O_RDONLY);
+            rapl_domain d;
+
+            d.fd = open((zone + "/energy_uj").c_str(), O_RDONLY);
+            d.range = 0;
+            d.total = 0;
+            if(rangefd >= 0)
+            {
+                read_ull(rangefd, d.range);
+                close(rangefd);
+            }
+            if(d.fd >= 0 && read_ull(d.fd, d.last))
+                rapl.push_back(d);
+            else if(d.fd >= 0)
+                close(d.fd);
+        }
+        free(namelist[i]);
+    }
+    if(n >= 0)
+        free(namelist);
+}
+
+static void close_sources()
+{
+    for(size_t i = 0; i < freq_fds.size(); i++)
+        if(freq_fds[i] >= 0)
+            close(freq_fds[i]);
+    for(size_t i = 0; i < rapl.size(); i++)
+        close(rapl[i].fd);
+    freq_fds.clear();
+    rapl.clear();
+}
+
+static void take_sample()
+{
+    vector < double > freq(freq_fds.size(), 0.0);
+    double energy = 0;
+
+    for(size_t i = 0; i < freq_fds.size(); i++)
+    {
+        unsigned long long khz = 0;
+
+        if(freq_fds[i] >= 0 && read_ull(freq_fds[i], khz))
+            freq[i] = khz / 1000.0;
+    }
+
+    for(size_t i = 0; i < rapl.size(); i++)
+    {
+        unsigned long long uj = 0;
+
+        if(read_ull(rapl[i].fd, uj))
+        {
+            if(uj >= rapl[i].last)
+                rapl[i].total += uj - rapl[i].last;
+            else if(rapl[i].range)
+                rapl[i].total += rapl[i].range - rapl[i].last + uj;
+            rapl[i].last = uj;
+        }
+        energy += rapl[i].total * 1e-6;
+    }
+
+    series.time.push_back(now() - started);
+    series.freq.push_back(freq);
+    series.temperature.push_back(sensors_package());
+    series.energy.push_back(energy);
+}
+
+static void *sample_loop(void *)
+{
+    while(__atomic_load_n(&running, __ATOMIC_ACQUIRE))
+    {
+        struct timespec delay;
+
+        take_sample();
+
+        delay.tv_sec = interval / 1000000000L;
+        delay.tv_nsec = interval % 1000000000L;
+        nanosleep(&delay, NULL);
+    }
+    take_sample();  // closing sample, right when the benchmark ends
+
+    return NULL;
+}
+
+bool telemetry_start(double rate)
+{
+    bool result = false;
+
+    if(rate <= 0)
+        return false;
+
+    pthread_mutex_lock(&telemetry_lock);
+    if(!running)
+    {
+        series = telemetry();
+        interval = (long) (1e9 / rate);
+        started = now();
+        open_sources();
+
+        running = true;
+        result = (pthread_create(&sampler, NULL, sample_loop, NULL) == 0);
+        running = result;
+        if(!result)
+            close_sources();
+    }
+    pthread_mutex_unlock(&telemetry_lock);
+
+    return result;
+}
+
+telemetry telemetry_stop()
+{
+    telemetry result;
+
+    pthread_mutex_lock(&telemetry_lock);
+    if(running)
+    {
+        __atomic_store_n(&running, false, __ATOMIC_RELEASE);
+        pthread_join(sampler, NULL);
+        close_sources();
+        result = series;
+        series = telemetry();
+    }
+    pthread_mutex_unlock(&telemetry_lock);
+
+    return result;
+}
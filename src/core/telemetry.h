@@ -0,0 +1,23 @@
+#ifndef _TELEMETRY_H_
+#define _TELEMETRY_H_
+
+#include <string>
+#include <vector>
+
+using namespace std;
+
+/*
+ * Time series recorded by a sidecar thread while a benchmark runs, to
+ * tell whether the result was throttled.
+ */
+struct telemetry
+{
+    vector<double> time;            // seconds since telemetry_start
+    vector< vector<double> > freq;  // MHz, one entry per CPU
+    vector<double> temperature;     // CPU package, degrees C, 0 if unknown
+    vector<double> energy;          // RAPL package joules since start, 0 if unknown
+};
+
+bool telemetry_start(double rate);
+telemetry telemetry_stop();
+#endif
@@ -10,6 +10,7 @@
 #include "osutils.h"
 #include "heuristics.h"
 #include "options.h"
+#include "scancontext.h"
 #include <stdio.h>
 #include <map>
 #include <sys/types.h>
@@ -61,8 +62,6 @@
 #define USB_SC_WIRELESSRADIO    1
 #define USB_PROT_BLUETOOTH    1
 
-static map<u_int16_t, string> usbvendors;
-static map<u_int32_t, string> usbproducts;
 
 #define PRODID(x, y) ((x << 16) + y)
 
@@ -260,14 +259,17 @@ static bool setUSBClass(hwNode & device, unsigned cls, unsigned sub, unsigned pr
 
 static bool describeUSB(hwNode & device, unsigned vendor, unsigned prodid)
 {
+    map < u_int16_t, string > & usbvendors = scan_context().usbvendors;
+    map < u_int32_t, string > & usbproducts = scan_context().usbproducts;
+
     if(usbvendors.find(vendor) == usbvendors.end()) return false;
 
-    device.setVendor(usbvendors[vendor]+(enabled("output:numeric") ? " [" + tohex(vendor) + "]" : ""));
+    device.setVendor(usbvendors[vendor]+(enabled(OPT_OUTPUT_NUMERIC) ? " [" + tohex(vendor) + "]" : ""));
     device.addHint("usb.idVendor", vendor);
     device.addHint("usb.idProduct", prodid);
 
     if(usbproducts.find(PRODID(vendor, prodid)) != usbproducts.end())
-        device.setProduct(usbproducts[PRODID(vendor, prodid)]+(enabled("output:numeric") ? " [" + tohex(vendor) + ":" + tohex(prodid) + "]" : ""));
+        device.setProduct(usbproducts[PRODID(vendor, prodid)]+(enabled(OPT_OUTPUT_NUMERIC) ? " [" + tohex(vendor) + ":" + tohex(prodid) + "]" : ""));
 
     return true;
 }
@@ -276,6 +278,8 @@ static bool load_usbids(const string & name)
 {
     FILE * usbids = NULL;
     u_int16_t vendorid = 0;
+    map < u_int16_t, string > & usbvendors = scan_context().usbvendors;
+    map < u_int32_t, string > & usbproducts = scan_context().usbproducts;
 
     usbids = fopen(name.c_str(), "r");
     if(!usbids) return false;
@@ -442,9 +446,9 @@ bool scan_usb(hwNode & n)
                             if(sscanf(line.c_str(), "S: %80[^=]=%80[ -z]", strname, strval) > 0)
                             {
                                 if(strcasecmp(strname, "Manufacturer") == 0)
-                                    device.setVendor(hw::strip(strval)+(enabled("output:numeric") ? " [" + tohex(vendor) + "]" : ""));
+                                    device.setVendor(hw::strip(strval)+(enabled(OPT_OUTPUT_NUMERIC) ? " [" + tohex(vendor) + "]" : ""));
                                 if(strcasecmp(strname, "Product") == 0)
-                                    device.setProduct(hw::strip(strval)+(enabled("output:numeric") ? " [" + tohex(vendor) + ":" + tohex(prodid) + "]" : ""));
+                                    device.setProduct(hw::strip(strval)+(enabled(OPT_OUTPUT_NUMERIC) ? " [" + tohex(vendor) + ":" + tohex(prodid) + "]" : ""));
                                 if(strcasecmp(strname, "SerialNumber") == 0)
                                     device.setSerial(hw::strip(strval));
                             }
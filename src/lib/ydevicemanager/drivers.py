@@ -11,8 +11,8 @@ __date__ = "$2011-9-13 17:48:51$"
 import gettext
 import os
 import re
-from parsexml import Parser
-from syscall import ui_down
+from parsexml import Parser, alias_index
+from syscall import ui_down, driver_sha1
 
 gettext.textdomain('ydm')
 def _(s):
@@ -86,18 +86,26 @@ class Driver:
 
         self.alias_cache = {}
         self.dri_list = {}
+        self.index = None
+
+        self.vendor_pattern_re = re.compile('(pci|usb):v([0-9A-F]{4,8})(?:d|p)')
+        self.key_pattern_re = re.compile('(pci|usb):v([0-9A-F]{4,8})(?:d|p)([0-9A-F]{4,8})')
 
         self.status, self.output = ui_down()
         if self.status:
             return
 
+        try:
+            self.index = alias_index(self.output, driver_sha1())
+        except:
+            self.index = None
+        if self.index is not None:
+            return
+
         dri_xml = Parser()
         dri_xml.feed(self.output)
         dri_xml.close()
 
-        self.vendor_pattern_re = re.compile('(pci|usb):v([0-9A-F]{4,8})(?:d|p)')
-        self.key_pattern_re = re.compile('(pci|usb):v([0-9A-F]{4,8})(?:d|p)([0-9A-F]{4,8})')
-
         dri_db = dri_xml.pcid.iteritems()
 
         '''web'''
@@ -108,7 +116,7 @@ class Driver:
                     if vp:
                         self.alias_cache.setdefault(vp.group(1), {}).setdefault(vp.group(2), \
                         {}).setdefault(alias, []).append((module, pkg))
-        
+
     def packed_env_string(self):
 
         env = dict(os.environ)
@@ -174,9 +182,28 @@ class Driver:
                         
         return pcid
 
+    def _native_query(self):
+
+        '''sysfs walk and alias index lookups done in lshw'''
+        for modalias, mods in self.index.match_devices().iteritems():
+            vp = self.key_pattern_re.match(modalias)
+            if not vp:
+                continue
+
+            key = vp.group(2)[-4:] + ":" + vp.group(3)[-4:]
+            pcid = {}
+            for (mod, pkg) in mods:
+                if pkg:
+                    pcid.setdefault(key, []).append((mod, pkg))
+            self.dri_list.update(pcid)
+
     def get_drivers(self):
         
         '''get driver list'''
+        if self.index is not None:
+            self._native_query()
+            return
+
         hardware = self.get_hardware()
         for hwid in hardware:
             pcid = self._do_query(hwid)
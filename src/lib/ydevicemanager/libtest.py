@@ -52,7 +52,7 @@ class TestThread(Thread, BaseFucn):
         self.base.statelabel.set_markup("<span foreground='#0092CE' font_desc='10'>%s</span>" \
         % _("Disk performance testing is in progress ..."))
         time.sleep(1)
-        rwio = sysbench()
+        rwio = disk_bench()
 
         self.base.statelabel.set_markup("<span foreground='#0092CE' font_desc='10'>%s</span>" \
         % _("Card performance testing is in progress ..."))
@@ -60,8 +60,8 @@ class TestThread(Thread, BaseFucn):
         fps = gear_fps()
 
         fp = open(TEST_Z, 'w')
-        fp.write("cpu = %s\nmem = %s\nr-io = %s\nw-io = %s\ncard = %s" \
-                 %(pi, mem, rwio.get('read'), rwio.get('write'), fps))
+        fp.write("cpu = %s\nmem = %s\nr-io = %s\nw-io = %s\nio-buffered = %s\ncard = %s\ntelemetry = %r\ndisks = %r" \
+                 %(pi, mem, rwio.get('read'), rwio.get('write'), rwio.get('buffered', False), fps, telemetry_summary(), rwio.get('disks', {})))
         fp.close()
 
 
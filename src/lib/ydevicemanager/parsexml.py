@@ -2,7 +2,10 @@
 # -*- coding:utf-8 -*-
 
 import gc
+import os
 import re
+import glob
+import hashlib
 from xml.parsers import expat
 
 class Parser:
@@ -55,4 +58,24 @@ class Parser:
     def close(self):
         del self._parser
         gc.collect()
-        
+
+def alias_index(path, sha1=None):
+    '''native alias index of the catalogue, built once per download'''
+    import lshw
+
+    if not sha1:
+        hash_new = hashlib.sha1()
+        with open(path, 'rb') as fp:
+            hash_new.update(fp.read())
+        sha1 = hash_new.hexdigest()
+
+    index_path = "%s.%s.idx" %(path, sha1)
+    index = lshw.alias_index()
+    if index.open(index_path):
+        return index
+
+    for old in glob.glob("%s.*.idx" %path):
+        os.remove(old)
+    if lshw.build_alias_index(path, index_path) < 0 or not index.open(index_path):
+        return None
+    return index
@@ -331,8 +331,16 @@ def ui_down():
     else:
         return check_file("%s/driver.xml.tar.bz2" %TARGET_DIR, url)
 
+DRIVER_SHA1 = None
+
+def driver_sha1():
+    '''sha1 of the last verified driver catalogue, None if unverified'''
+    return DRIVER_SHA1
+
 def check_file(tar_file, url):
     '''check file'''
+    global DRIVER_SHA1
+    DRIVER_SHA1 = None
     hash_new = hashlib.sha1()
     with open(tar_file, 'rb') as fp:
         while True:
@@ -353,6 +361,7 @@ def check_file(tar_file, url):
 
     if hash_value == sha1sum:
         os.system("tar -jxf %s -C %s" %(tar_file, TARGET_DIR))
+        DRIVER_SHA1 = hash_value
         return 0, "%s/driver.xml" %TARGET_DIR
     else:
         #return P_Errno, "File checksum error!"
@@ -369,41 +378,76 @@ def xz_file():
         return 0
     except:return 1
 
+TELEMETRY = {}
+
+def traced(name, test):
+    '''run test, keep the frequency/temperature/energy series'''
+    import lshw
+    ret, series = lshw.traced(test, 2)
+    TELEMETRY[name] = series
+    return ret
+
+def telemetry_summary():
+    ret = {}
+    for name, series in TELEMETRY.items():
+        if not series["time"]:
+            continue
+        freqs = [sum(f)/len(f) for f in series["freq"] if f]
+        ret[name] = {"maxtemp": max(series["temperature"]),
+                     "minfreq": min(freqs) if freqs else 0,
+                     "energy": series["energy"][-1]}
+    return ret
+
 def super_pi():
     ret = ''
     try:
         import lshw
-        ret = "%.3fs" %lshw.super_pi()
+        ret = "%.3fs" %traced("cpu", lshw.super_pi)
     except:
         print >> sys.stderr, 'super_pi  failed!'
     return ret
 
-def sysbench():
+def disk_bench():
     ret = {}
     '''判断livecd模式'''
     if not os.system("mount | grep -w rofs") and not os.system("mount | grep -w aufs"):
         return ret
+    sample = None
     try:
-        os.chdir(TARGET_DIR)
-        '''生成测试样本'''
-        get_output('sysbench --test=fileio --num-threads=16 --file-total-size=1G --file-test-mode=rndrw prepare')
-        '''开始测试'''
-        info = get_output('sysbench --test=fileio --num-threads=16 --file-total-size=1G --file-test-mode=rndrw run')
-        tmp = re.findall("Read (\S*)\s*Written (\S*)", info)
-        '''清理临时文件'''
-        get_output('sysbench --test=fileio --num-threads=100 --file-total-size=1G --file-test-mode=rndrw cleanup')
-        if tmp:
-            ret["read"] = tmp[0][0]
-            ret["write"] = tmp[0][1]
+        import lshw
+        import tempfile
+        '''16 深度队列, 16K 随机读写, 1G 测试样本, 读写共用一个样本文件'''
+        '''样本是新建的空文件: 写测试先铺开它, 读测试再只读'''
+        fd, sample = tempfile.mkstemp(prefix="diskbench-", dir=TARGET_DIR)
+        os.close(fd)
+        write = lshw.disk_bench(sample, "randwrite", 16, 16384, 1 << 30, 10)
+        read = lshw.disk_bench(sample, "randread", 16, 16384, 1 << 30, 10)
+        if read.engine and write.engine:
+            ret["read"] = "%.2fMb" %(read.bandwidth/1024/1024)
+            ret["write"] = "%.2fMb" %(write.bandwidth/1024/1024)
+            '''文件系统不支持 O_DIRECT 时测到的是页缓存'''
+            ret["buffered"] = not (read.direct and write.direct)
+
+        '''各磁盘的随机读, 只读不写, 打不开(非 root)的跳过'''
+        hw = lshw.lshw()
+        hw.scan_partial(classes=["disk"])
+        disks = {}
+        for disk in hw.get_disks():
+            result = lshw.disk_bench(disk, "randread", 16, 16384, 1 << 30, 5)
+            if result.engine:
+                disks[disk] = "%.2fMb" %(result.bandwidth/1024/1024)
+        ret["disks"] = disks
     except:
-        print 'sysbench --test=fileio failed!'
+        print >> sys.stderr, 'disk_bench failed!'
+    if sample and os.path.exists(sample):
+        os.remove(sample)
     return ret
 
 def stream_triad():
     ret = ''
     try:
         import lshw
-        ret = "%.3fGB/s" %(lshw.stream_triad()/1024)
+        ret = "%.3fGB/s" %(traced("mem", lshw.stream_triad)/1024)
     except:
         print >> sys.stderr, 'stream_triad  failed!'
     return ret
@@ -412,7 +456,7 @@ def gear_fps():
     ret = ''
     try:
         import lshw
-        ret = "%.2fFPS" %lshw.gear_fps()
+        ret = "%.2fFPS" %traced("card", lshw.gear_fps)
     except:
         print >> sys.stderr, 'gear_fps  failed!'
     return ret